@@ -139,6 +139,51 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
   block->write_cnt++;
 }
 
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Uses a single driver request if the driver supports it. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     void *buffer, block_sector_t cnt)
+{
+  block_sector_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  if (block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, buffer, cnt);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read (block->aux, sector + i,
+                        (uint8_t *) buffer + i * BLOCK_SECTOR_SIZE);
+  block->read_cnt += cnt;
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Uses a single driver request if the driver supports it. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      const void *buffer, block_sector_t cnt)
+{
+  block_sector_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, buffer, cnt);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->write (block->aux, sector + i,
+                         (const uint8_t *) buffer + i * BLOCK_SECTOR_SIZE);
+  block->write_cnt += cnt;
+}
+
 /* Returns the number of sectors in BLOCK. */
 block_sector_t
 block_size (struct block *block)
@@ -160,6 +205,20 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Returns the number of sectors read from BLOCK. */
+unsigned long long
+block_read_cnt (struct block *block)
+{
+  return block->read_cnt;
+}
+
+/* Returns the number of sectors written to BLOCK. */
+unsigned long long
+block_write_cnt (struct block *block)
+{
+  return block->write_cnt;
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
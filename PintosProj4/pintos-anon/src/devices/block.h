@@ -53,11 +53,17 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, void *,
+                          block_sector_t cnt);
+void block_write_multiple (struct block *, block_sector_t, const void *,
+                           block_sector_t cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
 /* Statistics. */
 void block_print_stats (void);
+unsigned long long block_read_cnt (struct block *);
+unsigned long long block_write_cnt (struct block *);
 
 /* Lower-level interface to block device drivers. */
 
@@ -65,6 +71,13 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional: transfer CNT consecutive sectors at once.  If null,
+       the block layer falls back to one read or write per sector. */
+    void (*read_multiple) (void *aux, block_sector_t, void *buffer,
+                           block_sector_t cnt);
+    void (*write_multiple) (void *aux, block_sector_t, const void *buffer,
+                            block_sector_t cnt);
   };
 
 struct block *block_register (const char *name, enum block_type,
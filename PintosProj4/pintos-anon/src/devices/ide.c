@@ -34,6 +34,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +50,12 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+
+/* Most sectors transferred by a single read or write command. */
+#define MAX_SECTORS_PER_CMD 128
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +64,8 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt in READ/WRITE
+                                   MULTIPLE, 0 if not in use. */
   };
 
 /* An ATA channel (aka controller).
@@ -85,7 +94,10 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, const uint16_t *id);
+
+static void select_sector (struct ata_disk *, block_sector_t,
+                           block_sector_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -136,6 +148,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
         }
 
       /* Register interrupt handler. */
@@ -281,6 +294,9 @@ identify_ata_device (struct ata_disk *d)
     }
   input_sector (c, id);
 
+  /* Transfer several sectors per interrupt, if the disk can. */
+  set_multiple_mode (d, (const uint16_t *) id);
+
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
@@ -309,6 +325,31 @@ identify_ata_device (struct ata_disk *d)
   partition_scan (block);
 }
 
+/* Enables READ/WRITE MULTIPLE on disk D, whose IDENTIFY DEVICE
+   response is ID, with as many sectors per interrupt as it supports
+   (a power of 2, at most MAX_SECTORS_PER_CMD).  Leaves D->multiple
+   at 0 if it does not support them. */
+static void
+set_multiple_mode (struct ata_disk *d, const uint16_t *id)
+{
+  struct channel *c = d->channel;
+  int max = id[47] & 0xff;
+  int cnt;
+
+  if (max == 0)
+    return;
+  for (cnt = 1; cnt * 2 <= max && cnt * 2 <= MAX_SECTORS_PER_CMD; cnt *= 2)
+    continue;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) == 0)
+    d->multiple = cnt;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,40 +378,98 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes, issuing
+   one command per MAX_SECTORS_PER_CMD sectors.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, void *buffer_,
+                   block_sector_t cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+  /* Sectors transferred per interrupt. */
+  block_sector_t per_intr = d->multiple > 0 ? d->multiple : 1;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      block_sector_t n = cnt < MAX_SECTORS_PER_CMD ? cnt : MAX_SECTORS_PER_CMD;
+      block_sector_t done, i;
+
+      select_sector (d, sec_no, n);
+      issue_pio_command (c, d->multiple > 0 ? CMD_READ_MULTIPLE
+                                            : CMD_READ_SECTOR_RETRY);
+      for (done = 0; done < n; done += i)
+        {
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + done);
+          for (i = 0; i < per_intr && done + i < n; i++)
+            input_sector (c, buffer + (done + i) * BLOCK_SECTOR_SIZE);
+        }
+
+      sec_no += n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
-struct block_new
-  {
-    struct list_elem list_elem;         /* Element in all_blocks. */
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d_, sec_no, buffer, 1);
+}
 
-    char name[16];                      /* Block device name. */
-    enum block_type type;                /* Type of block device. */
-    block_sector_t size;                 /* Size in sectors. */
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes, issuing one
+   command per MAX_SECTORS_PER_CMD sectors.  Returns after the disk
+   has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, const void *buffer_,
+                    block_sector_t cnt)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+  /* Sectors transferred per interrupt. */
+  block_sector_t per_intr = d->multiple > 0 ? d->multiple : 1;
 
-    const struct block_operations *ops;  /* Driver operations. */
-    void *aux;                          /* Extra data owned by driver. */
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      block_sector_t n = cnt < MAX_SECTORS_PER_CMD ? cnt : MAX_SECTORS_PER_CMD;
+      block_sector_t done, i;
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
-  };
+      select_sector (d, sec_no, n);
+      issue_pio_command (c, d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                                            : CMD_WRITE_SECTOR_RETRY);
+      for (done = 0; done < n; done += i)
+        {
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + done);
+          for (i = 0; i < per_intr && done + i < n; i++)
+            output_sector (c, buffer + (done + i) * BLOCK_SECTOR_SIZE);
+          sema_down (&c->completion_wait);
+        }
 
+      sec_no += n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+  lock_release (&c->lock);
+}
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
    BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
@@ -380,43 +479,30 @@ struct block_new
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  // printf("175453534\n");
-
-// if(lock_held_by_current_thread (&c->lock))
-// {
-//   lock_release(&c->lock);
-// }
-  lock_acquire (&c->lock);
-  // printf("++++++++++++_=-=-==-=\n");
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  ide_write_multiple (d_, sec_no, buffer, 1);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple
   };
-
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the number of sectors to transfer, CNT, to the
+   disk's sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_CMD);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -93,12 +93,12 @@ timer_sleep (int64_t ticks)
   int64_t start = timer_ticks ();
 
   ASSERT (intr_get_level () == INTR_ON);
-  enum intr_level old_level = intr_disable ();
+  if (ticks <= 0)
+    return;
 
-  // sleep the thread for `ticks` seconds,
+  // sleep the thread for `ticks` ticks,
   // until the tick becomes [start + ticks]
-
-  intr_set_level (old_level);
+  thread_sleep_until (start + ticks);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -6,7 +6,9 @@
 
    By default, only the name of each file is printed.  If "-l" is
    given as the first argument, the type, size, and inumber of
-   each file is also printed.  This won't work until project 4. */
+   each file is also printed.  This won't work until project 4.
+
+   Entries are read with getdents, many at a time. */
 
 #include <syscall.h>
 #include <stdio.h>
@@ -24,39 +26,40 @@ list_dir (const char *dir, bool verbose)
 
   if (isdir (dir_fd))
     {
-      char name[READDIR_MAX_LEN];
+      struct dirent entries[32];
+      int cnt, i;
 
       printf ("%s", dir);
       if (verbose)
         printf (" (inumber %d)", inumber (dir_fd));
       printf (":\n");
 
-      while (readdir (dir_fd, name)) 
-        {
-          printf ("%s", name); 
-          if (verbose) 
-            {
-              char full_name[128];
-              int entry_fd;
+      while ((cnt = getdents (dir_fd, entries, sizeof entries)) > 0)
+        for (i = 0; i < cnt; i++)
+          {
+            struct dirent *e = &entries[i];
+
+            printf ("%s", e->name); 
+            if (verbose && e->is_dir)
+              printf (": directory, inumber %d", e->inumber);
+            else if (verbose) 
+              {
+                char full_name[128];
+                int entry_fd;
 
-              snprintf (full_name, sizeof full_name, "%s/%s", dir, name);
-              entry_fd = open (full_name);
+                snprintf (full_name, sizeof full_name, "%s/%s", dir, e->name);
+                entry_fd = open (full_name);
 
-              printf (": ");
-              if (entry_fd != -1)
-                {
-                  if (isdir (entry_fd))
-                    printf ("directory");
-                  else
-                    printf ("%d-byte file", filesize (entry_fd));
-                  printf (", inumber %d", inumber (entry_fd));
-                }
-              else
-                printf ("open failed");
-              close (entry_fd);
-            }
-          printf ("\n");
-        }
+                printf (": ");
+                if (entry_fd != -1)
+                  printf ("%d-byte file, inumber %d",
+                          filesize (entry_fd), e->inumber);
+                else
+                  printf ("open failed");
+                close (entry_fd);
+              }
+            printf ("\n");
+          }
     }
   else 
     printf ("%s: not a directory\n", dir);
@@ -1,152 +1,953 @@
 #include <debug.h>
+#include <stdio.h>
+#include <cache-stats.h>
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include <stdlib.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "filesys/cache.h"
 
 // #define DEBUG
 
-#define BUFFER_CACHE_SIZE 64
+/* Number of cache entries (see -cache on the kernel command line),
+   and the least number of them that memory pressure may leave. */
+#define BUFFER_CACHE_SIZE_DEFAULT 512
+#define BUFFER_CACHE_SIZE_MIN 64
+
+/* Sector data is kept in pages, each shared by this many entries. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Maximum number of runs waiting for the read-ahead thread, and the
+   most sectors it reads with one request. */
+#define READ_AHEAD_QUEUE_SIZE 32
+#define READ_AHEAD_RUN_MAX SECTORS_PER_PAGE
+
+/* Defaults of the write-behind flusher (see -flush-interval and
+   -flush-threshold on the kernel command line). */
+#define FLUSH_INTERVAL_DEFAULT (5 * TIMER_FREQ)     /* in timer ticks */
+
+/* Locking protocol.
+
+   buffer_cache_lock protects the index, the free list, the clock hand,
+   the pages and the `occupied', `disk_sector', `buffer', `access',
+   `in_flight' and `pin_cnt' members of every entry, and dirty_cnt.  It
+   is never held across disk I/O, but may be taken while holding an
+   entry's rwlock.
+
+   The sector data and the dirty bit of an entry are protected by the
+   entry's own `rwlock': shared for readers, exclusive for writers and
+   for whoever moves data between the entry and the disk.  A thread may
+   only wait on an entry's rwlock while it has the entry pinned, so an
+   unpinned entry has an uncontended rwlock, which lets the evictor
+   take it while holding buffer_cache_lock without sleeping. */
+
+/* Resident queues of the 2Q replacement policy. */
+enum twoq_queue
+  {
+    TWOQ_NONE,      /* Not on any queue (clock policy, or unoccupied). */
+    TWOQ_A1IN,      /* Referenced once: FIFO. */
+    TWOQ_AM         /* Referenced again after leaving A1in: LRU. */
+  };
 
 struct buffer_cache_entry_t {
   bool occupied;  // true only if this entry is valid cache entry
 
   block_sector_t disk_sector;
-  uint8_t buffer[BLOCK_SECTOR_SIZE];
+  uint8_t *buffer;  // BLOCK_SECTOR_SIZE bytes in a page, NULL if detached
 
   bool dirty;     // dirty bit
-  bool access;    // reference bit, for clock algorithm
+  bool access;    // reference bit, for clock algorithm (and the shrinker)
+
+  bool in_flight; // true while the buffer is being read or written back
+  bool read_ahead;  // read ahead, but not accessed on demand since
+  int pin_cnt;    // number of threads using (or waiting for) this entry
+  struct rw_lock rwlock;    // guards buffer and dirty, see above
+
+  struct hash_elem helem;   // see ::buffer_cache_index (if occupied)
+  struct list_elem lelem;   // see ::buffer_cache_free_list (if not occupied)
+
+  enum twoq_queue queue;    // 2Q queue this entry is on (if occupied)
+  struct list_elem qelem;   // see ::twoq_a1in, ::twoq_am
 };
 
-/* Buffer cache entries. */
-static struct buffer_cache_entry_t cache[BUFFER_CACHE_SIZE];
+/* A page holding the sector data of SECTORS_PER_PAGE consecutive
+   entries, kept apart from the entries so that a lookup key does not
+   drag a whole sector along with it.
 
-/* A global lock for synchronizing buffer cache operations. */
+   The pages come from the user pool, so that the cache competes with
+   user processes for memory: buffer_cache_shrink() gives clean pages
+   back when frames run short, and a miss takes a detached page again
+   once the user pool has free pages. */
+struct buffer_cache_page_t {
+  void *kpage;              // NULL if detached (given back to palloc)
+  struct hash_elem helem;   // see ::buffer_cache_pages (if attached)
+};
+
+/* Buffer cache entries, and their pages. */
+static size_t cache_cnt = BUFFER_CACHE_SIZE_DEFAULT;
+static struct buffer_cache_entry_t *cache;
+static size_t cache_page_cnt;
+static struct buffer_cache_page_t *cache_pages;
+static size_t cache_pages_attached;
+
+/* A mapping from page address to the attached page, for buffer_cache_put(). */
+static struct hash buffer_cache_pages;
+
+/* A mapping from disk sector to the (occupied) entry caching it. */
+static struct hash buffer_cache_index;
+
+/* Unoccupied, unpinned entries, handed out before the clock algorithm runs. */
+static struct list buffer_cache_free_list;
+
+/* A global lock for synchronizing buffer cache metadata. */
 static struct lock buffer_cache_lock;
 
+/* Signaled when an entry becomes unpinned (and thus evictable). */
+static struct condition buffer_cache_unpinned;
+
+/* Statistics, protected by buffer_cache_lock. */
+static struct cache_stats stats;
+
+/* A replacement policy.  All hooks are called with buffer_cache_lock
+   held; the common code maintains the `access' bits itself. */
+struct buffer_cache_policy {
+  const char *name;             // as given to -cache-policy
+  void (*init) (void);
+  void (*touch) (struct buffer_cache_entry_t *);    // cache hit on an entry
+  void (*install) (struct buffer_cache_entry_t *);  // entry got a new sector
+  void (*remove) (struct buffer_cache_entry_t *);   // entry loses its sector
+  struct buffer_cache_entry_t *(*victim) (void);    // unpinned, occupied or NULL
+};
+
+static const struct buffer_cache_policy clock_policy, twoq_policy;
+static const struct buffer_cache_policy *policy = &clock_policy;
+
+/* Acquires buffer_cache_lock, accounting for the time spent waiting. */
+static void
+buffer_cache_lock_acquire (void)
+{
+  if (lock_try_acquire (&buffer_cache_lock))
+    return;
+
+  int64_t start = timer_ticks ();
+  lock_acquire (&buffer_cache_lock);
+  stats.lock_waits ++;
+  stats.lock_wait_ticks += timer_ticks () - start;
+}
+
+/* Acquires the rwlock of SLOT (exclusively if EXCLUSIVE, shared
+   otherwise), accounting for the time spent waiting. */
+static void
+buffer_cache_entry_lock (struct buffer_cache_entry_t *slot, bool exclusive)
+{
+  if (exclusive ? rw_lock_try_acquire_exclusive (&slot->rwlock)
+                : rw_lock_try_acquire_shared (&slot->rwlock))
+    return;
+
+  int64_t start = timer_ticks ();
+  if (exclusive)
+    rw_lock_acquire_exclusive (&slot->rwlock);
+  else
+    rw_lock_acquire_shared (&slot->rwlock);
+
+  buffer_cache_lock_acquire ();
+  stats.lock_waits ++;
+  stats.lock_wait_ticks += timer_ticks () - start;
+  lock_release (&buffer_cache_lock);
+}
+
+/* Accounts for the sector cached in E being dropped. */
+static void
+buffer_cache_account_drop (struct buffer_cache_entry_t *e)
+{
+  if (e->read_ahead)
+    stats.read_ahead_wasted ++;
+  e->read_ahead = false;
+}
+
+/* Runs of consecutive sectors queued for the read-ahead thread
+   (a ring buffer), protected by read_ahead_lock. */
+struct read_ahead_run {
+  block_sector_t sector;    // first sector
+  size_t cnt;               // number of sectors, at most READ_AHEAD_RUN_MAX
+};
+static struct read_ahead_run read_ahead_queue[READ_AHEAD_QUEUE_SIZE];
+static size_t read_ahead_head;      // index of the oldest request
+static size_t read_ahead_cnt;       // number of queued requests
+static struct lock read_ahead_lock;
+static struct condition read_ahead_nonempty;
+
+static void read_ahead_daemon (void *aux);
+
+/* Serializes the use of the buffer of buffer_cache_fetch_block(). */
+static struct lock fetch_lock;
+
+/* Write-behind: the flusher writes dirty entries back every
+   flush_interval ticks, or as soon as dirty_cnt reaches flush_threshold.
+   Zero disables the respective trigger. */
+static int64_t flush_interval = FLUSH_INTERVAL_DEFAULT;
+static size_t flush_threshold;      // defaults to half of the entries
+static bool flush_threshold_set;
+static size_t dirty_cnt;            // number of dirty entries, see buffer_cache_lock
+static struct semaphore flush_request;  // up'd to wake the flusher
+static struct lock flush_lock;      // serializes buffer_cache_flush()
+
+static void flush_daemon (void *aux);
+static void flush_timer_daemon (void *aux);
+
+// Hash Functions required for [buffer_cache_index]. Uses 'disk_sector' as key.
+static unsigned
+buffer_cache_hash_func (const struct hash_elem *elem, void *aux UNUSED)
+{
+  struct buffer_cache_entry_t *entry = hash_entry (elem, struct buffer_cache_entry_t, helem);
+  return hash_int ((int) entry->disk_sector);
+}
+
+static bool
+buffer_cache_less_func (const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  struct buffer_cache_entry_t *a_entry = hash_entry (a, struct buffer_cache_entry_t, helem);
+  struct buffer_cache_entry_t *b_entry = hash_entry (b, struct buffer_cache_entry_t, helem);
+  return a_entry->disk_sector < b_entry->disk_sector;
+}
+
+// Hash Functions required for [buffer_cache_pages]. Uses 'kpage' as key.
+static unsigned
+buffer_cache_page_hash_func (const struct hash_elem *elem, void *aux UNUSED)
+{
+  struct buffer_cache_page_t *page = hash_entry (elem, struct buffer_cache_page_t, helem);
+  return hash_bytes (&page->kpage, sizeof page->kpage);
+}
+
+static bool
+buffer_cache_page_less_func (const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  struct buffer_cache_page_t *a_page = hash_entry (a, struct buffer_cache_page_t, helem);
+  struct buffer_cache_page_t *b_page = hash_entry (b, struct buffer_cache_page_t, helem);
+  return a_page->kpage < b_page->kpage;
+}
+
+/* Backs the (detached) page IDX with KPAGE, and makes its entries free. */
+static void
+buffer_cache_attach_page (size_t idx, void *kpage)
+{
+  struct buffer_cache_page_t *page = &cache_pages[idx];
+  size_t i;
+
+  ASSERT (page->kpage == NULL);
+  page->kpage = kpage;
+  hash_insert (&buffer_cache_pages, &page->helem);
+  cache_pages_attached ++;
+
+  for (i = 0; i < SECTORS_PER_PAGE; ++ i)
+  {
+    struct buffer_cache_entry_t *e = &cache[idx * SECTORS_PER_PAGE + i];
+    e->buffer = (uint8_t *) kpage + i * BLOCK_SECTOR_SIZE;
+    list_push_back (&buffer_cache_free_list, &e->lelem);
+  }
+}
+
+/* Sets the number of cache entries to CNT, which is rounded up to
+   whole pages.  Must be called before buffer_cache_init(). */
+void
+buffer_cache_set_size (size_t cnt)
+{
+  cache_cnt = cnt < BUFFER_CACHE_SIZE_MIN ? BUFFER_CACHE_SIZE_MIN : cnt;
+}
+
 /* initialize buffer_cache */
 void
 buffer_cache_init (void)
 {
   lock_init (&buffer_cache_lock);
+  cond_init (&buffer_cache_unpinned);
+  if (!hash_init (&buffer_cache_index, buffer_cache_hash_func,
+                  buffer_cache_less_func, NULL)
+      || !hash_init (&buffer_cache_pages, buffer_cache_page_hash_func,
+                     buffer_cache_page_less_func, NULL))
+    PANIC ("buffer cache index creation failed");
+  list_init (&buffer_cache_free_list);
+
+  cache_page_cnt = DIV_ROUND_UP (cache_cnt, SECTORS_PER_PAGE);
+  cache_cnt = cache_page_cnt * SECTORS_PER_PAGE;
+  cache = calloc (cache_cnt, sizeof *cache);
+  cache_pages = calloc (cache_page_cnt, sizeof *cache_pages);
+  if (cache == NULL || cache_pages == NULL)
+    PANIC ("can't allocate %zu buffer cache entries", cache_cnt);
 
-  // initialize entries
+  // initialize entries: every entry starts out detached
   size_t i;
-  for (i = 0; i < BUFFER_CACHE_SIZE; ++ i)
+  for (i = 0; i < cache_cnt; ++ i)
   {
     cache[i].occupied = false;
+    cache[i].buffer = NULL;
+    cache[i].in_flight = false;
+    cache[i].pin_cnt = 0;
+    rw_lock_init (&cache[i].rwlock);
+  }
+
+  // back them with user pool pages: in one go if possible, otherwise
+  // as many as there are; the rest is attached on demand later on.
+  cache_pages_attached = 0;
+  uint8_t *kpages = palloc_get_multiple (PAL_USER, cache_page_cnt);
+  for (i = 0; i < cache_page_cnt; ++ i)
+  {
+    void *kpage = kpages != NULL ? kpages + i * PGSIZE : palloc_get_page (PAL_USER);
+    if (kpage == NULL)
+      break;
+    buffer_cache_attach_page (i, kpage);
   }
+  if (cache_pages_attached * SECTORS_PER_PAGE < BUFFER_CACHE_SIZE_MIN)
+    PANIC ("not enough memory for the buffer cache");
+
+  if (!flush_threshold_set)
+    flush_threshold = cache_cnt / 2;
+  policy->init ();
+
+  // start the read-ahead thread
+  lock_init (&read_ahead_lock);
+  cond_init (&read_ahead_nonempty);
+  read_ahead_head = read_ahead_cnt = 0;
+  if (thread_create ("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL)
+      == TID_ERROR)
+    PANIC ("can't create read-ahead thread");
+
+  // start the write-behind flusher
+  dirty_cnt = 0;
+  sema_init (&flush_request, 0);
+  lock_init (&flush_lock);
+  lock_init (&fetch_lock);
+  if (thread_create ("flusher", PRI_DEFAULT, flush_daemon, NULL) == TID_ERROR)
+    PANIC ("can't create flusher thread");
+  if (flush_interval > 0
+      && thread_create ("flush-timer", PRI_DEFAULT, flush_timer_daemon, NULL)
+         == TID_ERROR)
+    PANIC ("can't create flush timer thread");
 }
 
+/* Sets the period of the write-behind flusher to TICKS timer ticks.
+   Must be called before buffer_cache_init(); 0 disables it. */
 void
-buffer_cache_close (void)
+buffer_cache_set_flush_interval (int64_t ticks)
 {
-  // flush buffer cache entries
-  lock_acquire (&buffer_cache_lock);
+  flush_interval = ticks;
+}
 
-  size_t i;
-  for (i = 0; i < BUFFER_CACHE_SIZE; ++ i)
-  {
-    if (cache[i].occupied == false) continue;
-    // buffer_cache_flush( &(cache[i]) );
-    if (cache[i].dirty) {
-      block_write (fs_device, cache[i].disk_sector, cache[i].buffer);
-      cache[i].dirty = false;
-    }
+/* Makes the flusher run as soon as CNT cache entries are dirty.
+   Must be called before buffer_cache_init(); 0 disables it. */
+void
+buffer_cache_set_flush_threshold (size_t cnt)
+{
+  flush_threshold = cnt;
+  flush_threshold_set = true;
+}
+
+/* Stores a snapshot of the buffer cache statistics into *S. */
+void
+buffer_cache_get_stats (struct cache_stats *s)
+{
+  if (cache == NULL) {
+    // not initialized (yet)
+    memset (s, 0, sizeof *s);
+    return;
   }
 
+  buffer_cache_lock_acquire ();
+  *s = stats;
   lock_release (&buffer_cache_lock);
+  s->disk_reads = block_read_cnt (fs_device);
+  s->disk_writes = block_write_cnt (fs_device);
+}
+
+/* Prints buffer cache statistics. */
+void
+buffer_cache_print_stats (void)
+{
+  // called at power off: don't wait for a lock that may never be released.
+  struct cache_stats s = stats;
+
+  printf ("Buffer cache: %s policy, %llu hits, %llu misses, "
+          "%llu clean and %llu dirty evictions, %llu write-backs\n",
+          policy->name, s.hits, s.misses,
+          s.clean_evictions, s.dirty_evictions, s.writebacks);
+  printf ("Buffer cache: %llu lock waits (%llu ticks), "
+          "read-ahead %llu issued, %llu used, %llu wasted\n",
+          s.lock_waits, s.lock_wait_ticks,
+          s.read_ahead_issued, s.read_ahead_used, s.read_ahead_wasted);
+}
+
+void
+buffer_cache_close (void)
+{
+  // flush buffer cache entries
+  buffer_cache_flush ();
 }
 
 
 /**
  * Lookup the cache entry, and returns the pointer of buffer_cache_entry_t,
- * or NULL in case of cache miss. (simply traverse the cache entries)
+ * or NULL in case of cache miss. (a single probe of buffer_cache_index)
  */
 static struct buffer_cache_entry_t*
 buffer_cache_lookup (block_sector_t sector)
 {
-  #ifdef DEBUG
-    printf("buffer_cache_lookup\n");
-  #endif
-  size_t i;
-  for (i = 0; i < BUFFER_CACHE_SIZE; ++ i)
-  {
-    if (cache[i].occupied == false) continue;
-    if (cache[i].disk_sector == sector) {
-      // cache hit.
-      #ifdef DEBUG
-        printf("end buffer_cache_lookup\n");
-      #endif
-      return &(cache[i]);
+  ASSERT (lock_held_by_current_thread(&buffer_cache_lock));
+
+  // hash lookup : a temporary entry
+  struct buffer_cache_entry_t key;
+  key.disk_sector = sector;
+
+  struct hash_elem *h = hash_find (&buffer_cache_index, &key.helem);
+  if (h == NULL)
+    return NULL; // cache miss
+  return hash_entry (h, struct buffer_cache_entry_t, helem);
+}
+
+/* Clock replacement: the classic second-chance algorithm over all
+   entries, driven by the `access' bits alone. */
+static void
+clock_init (void)
+{
+}
+
+static void
+clock_touch (struct buffer_cache_entry_t *e UNUSED)
+{
+}
+
+static void
+clock_install (struct buffer_cache_entry_t *e UNUSED)
+{
+}
+
+static void
+clock_remove (struct buffer_cache_entry_t *e UNUSED)
+{
+}
+
+static struct buffer_cache_entry_t*
+clock_victim (void)
+{
+  // two rounds are enough to find an unreferenced entry
+  static size_t clock = 0;
+  size_t it;
+  for (it = 0; it < 2 * cache_cnt; ++ it) {
+    struct buffer_cache_entry_t *e = &cache[clock];
+    clock ++;
+    clock %= cache_cnt;
+
+    if (!e->occupied || e->pin_cnt > 0)
+      continue;     // detached, or in use by someone else
+    if (e->access)
+      e->access = false;  // give a second chance
+    else
+      return e;
+  }
+  return NULL;
+}
+
+static const struct buffer_cache_policy clock_policy = {
+  "clock", clock_init, clock_touch, clock_install, clock_remove, clock_victim
+};
+
+/* 2Q replacement (Johnson and Shasha, VLDB '94).  A sector referenced
+   for the first time goes on A1in, a FIFO holding about a quarter of
+   the cache.  Sectors pushed out of A1in are remembered (without data)
+   on the A1out ghost FIFO; when one of them is referenced again, it is
+   promoted to Am, an LRU of the sectors proven to be reused.  A long
+   sequential scan thus only cycles through A1in and leaves Am, where
+   inodes, indirect blocks and directories end up, alone. */
+
+/* A sector recently evicted from A1in. */
+struct twoq_ghost {
+  block_sector_t sector;
+  struct hash_elem helem;   // see ::twoq_a1out_index
+  struct list_elem lelem;   // see ::twoq_a1out, ::twoq_ghost_free
+};
+
+static struct list twoq_a1in, twoq_am;  // resident, oldest first
+static size_t twoq_a1in_cnt;
+static struct list twoq_a1out;          // ghosts, oldest first
+static struct list twoq_ghost_free;     // unused ghosts
+static struct hash twoq_a1out_index;    // sector -> ghost on A1out
+
+// Hash Functions required for [twoq_a1out_index]. Uses 'sector' as key.
+static unsigned
+twoq_hash_func (const struct hash_elem *elem, void *aux UNUSED)
+{
+  struct twoq_ghost *ghost = hash_entry (elem, struct twoq_ghost, helem);
+  return hash_int ((int) ghost->sector);
+}
+
+static bool
+twoq_less_func (const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  struct twoq_ghost *a_ghost = hash_entry (a, struct twoq_ghost, helem);
+  struct twoq_ghost *b_ghost = hash_entry (b, struct twoq_ghost, helem);
+  return a_ghost->sector < b_ghost->sector;
+}
+
+static void
+twoq_init (void)
+{
+  // A1out remembers as many sectors as half of the cache holds.
+  size_t ghost_cnt = cache_cnt / 2, i;
+  struct twoq_ghost *ghosts = calloc (ghost_cnt, sizeof *ghosts);
+
+  list_init (&twoq_a1in);
+  list_init (&twoq_am);
+  list_init (&twoq_a1out);
+  list_init (&twoq_ghost_free);
+  twoq_a1in_cnt = 0;
+  if (ghosts == NULL
+      || !hash_init (&twoq_a1out_index, twoq_hash_func, twoq_less_func, NULL))
+    PANIC ("can't allocate the 2Q ghost queue");
+  for (i = 0; i < ghost_cnt; ++ i)
+    list_push_back (&twoq_ghost_free, &ghosts[i].lelem);
+}
+
+static void
+twoq_touch (struct buffer_cache_entry_t *e)
+{
+  // hits on A1in are mostly correlated references: leave them be.
+  if (e->queue == TWOQ_AM) {
+    list_remove (&e->qelem);
+    list_push_back (&twoq_am, &e->qelem);
+  }
+}
+
+static void
+twoq_install (struct buffer_cache_entry_t *e)
+{
+  // hash lookup : a temporary entry
+  struct twoq_ghost key;
+  key.sector = e->disk_sector;
+
+  struct hash_elem *h = hash_find (&twoq_a1out_index, &key.helem);
+  if (h != NULL) {
+    // referenced again after leaving A1in: it is worth keeping.
+    struct twoq_ghost *ghost = hash_entry (h, struct twoq_ghost, helem);
+    hash_delete (&twoq_a1out_index, &ghost->helem);
+    list_remove (&ghost->lelem);
+    list_push_back (&twoq_ghost_free, &ghost->lelem);
+
+    e->queue = TWOQ_AM;
+    list_push_back (&twoq_am, &e->qelem);
+  }
+  else {
+    e->queue = TWOQ_A1IN;
+    list_push_back (&twoq_a1in, &e->qelem);
+    twoq_a1in_cnt ++;
+  }
+}
+
+static void
+twoq_remove (struct buffer_cache_entry_t *e)
+{
+  list_remove (&e->qelem);
+  if (e->queue == TWOQ_A1IN) {
+    // remember the sector on A1out, forgetting the oldest one if full.
+    struct twoq_ghost *ghost;
+    if (!list_empty (&twoq_ghost_free))
+      ghost = list_entry (list_pop_front (&twoq_ghost_free), struct twoq_ghost, lelem);
+    else {
+      ghost = list_entry (list_pop_front (&twoq_a1out), struct twoq_ghost, lelem);
+      hash_delete (&twoq_a1out_index, &ghost->helem);
     }
+    ghost->sector = e->disk_sector;
+    hash_insert (&twoq_a1out_index, &ghost->helem);
+    list_push_back (&twoq_a1out, &ghost->lelem);
+    twoq_a1in_cnt --;
   }
-  return NULL; // cache miss
+  e->queue = TWOQ_NONE;
+}
+
+/* Returns the oldest unpinned entry on QUEUE, or NULL. */
+static struct buffer_cache_entry_t*
+twoq_oldest_unpinned (struct list *queue)
+{
+  struct list_elem *l;
+  for (l = list_begin (queue); l != list_end (queue); l = list_next (l)) {
+    struct buffer_cache_entry_t *e = list_entry (l, struct buffer_cache_entry_t, qelem);
+    if (e->pin_cnt == 0)
+      return e;
+  }
+  return NULL;
+}
+
+static struct buffer_cache_entry_t*
+twoq_victim (void)
+{
+  // A1in is kept at about a quarter of the (attached) entries.
+  size_t kin = cache_pages_attached * SECTORS_PER_PAGE / 4;
+  struct list *first = twoq_a1in_cnt > kin ? &twoq_a1in : &twoq_am;
+  struct list *second = first == &twoq_a1in ? &twoq_am : &twoq_a1in;
+
+  struct buffer_cache_entry_t *e = twoq_oldest_unpinned (first);
+  return e != NULL ? e : twoq_oldest_unpinned (second);
+}
+
+static const struct buffer_cache_policy twoq_policy = {
+  "2q", twoq_init, twoq_touch, twoq_install, twoq_remove, twoq_victim
+};
+
+/* Selects the replacement policy called NAME ("clock" or "2q").
+   Returns false if there is no such policy.  Must be called before
+   buffer_cache_init(). */
+bool
+buffer_cache_set_policy (const char *name)
+{
+  static const struct buffer_cache_policy *policies[] = {
+    &clock_policy, &twoq_policy
+  };
+  size_t i;
+  for (i = 0; i < sizeof policies / sizeof *policies; ++ i)
+    if (!strcmp (name, policies[i]->name)) {
+      policy = policies[i];
+      return true;
+    }
+  return false;
 }
 
-/* Obtain a free cache entry slot.
+/* Picks an entry to be reused, pins it and takes its rwlock exclusively.
    If there is an unoccupied slot already, return it.
-   Otherwise, slot->occupied will be set to false by the clock algorithm. */
+   Otherwise a victim is chosen by the replacement policy among the
+   unpinned entries; it is still occupied (and may be dirty) on return.
+   Returns NULL if every entry is pinned. */
 static struct buffer_cache_entry_t*
 buffer_cache_evict (void)
 {
   ASSERT (lock_held_by_current_thread(&buffer_cache_lock));
 
-  // clock algorithm
-  static size_t clock = 0;
+  struct buffer_cache_entry_t *slot = NULL;
+  if (list_empty (&buffer_cache_free_list)
+      && cache_pages_attached < cache_page_cnt) {
+    // grow back into memory given away under pressure, if it is free again.
+    void *kpage = palloc_get_page (PAL_USER);
+    if (kpage != NULL) {
+      size_t idx = 0;
+      while (cache_pages[idx].kpage != NULL)
+        idx ++;
+      buffer_cache_attach_page (idx, kpage);
+    }
+  }
+
+  if (!list_empty (&buffer_cache_free_list)) {
+    // found an empty slot -- use it
+    struct list_elem *e = list_pop_front (&buffer_cache_free_list);
+    slot = list_entry (e, struct buffer_cache_entry_t, lelem);
+  }
+  else {
+    slot = policy->victim ();
+    if (slot == NULL)
+      return NULL;
+  }
+
+  // nobody else has it pinned, so this never sleeps.
+  slot->pin_cnt ++;
+  rw_lock_acquire_exclusive (&slot->rwlock);
+  return slot;
+}
+
+/* Gives up SLOT, which was obtained from buffer_cache_evict() but
+   turned out not to be needed. */
+static void
+buffer_cache_unclaim (struct buffer_cache_entry_t *slot)
+{
+  ASSERT (lock_held_by_current_thread(&buffer_cache_lock));
+
+  rw_lock_release_exclusive (&slot->rwlock);
+  slot->pin_cnt --;
+  if (!slot->occupied)
+    list_push_front (&buffer_cache_free_list, &slot->lelem);
+  if (slot->pin_cnt == 0)
+    cond_signal (&buffer_cache_unpinned, &buffer_cache_lock);
+}
+
+static void buffer_cache_fetch_block (struct buffer_cache_entry_t *slot);
+
+/**
+ * Returns the entry caching SECTOR, pinned and with its rwlock held
+ * (exclusively if EXCLUSIVE, shared otherwise).
+ *
+ * On a cache miss an entry is reused; a dirty victim is written back
+ * and, if FETCH, the sector is read in, in both cases with only that
+ * entry locked.  If FETCH is false the buffer content of a newly
+ * installed entry is undefined: the caller must overwrite all of it.
+ * A demand fetch brings in the rest of the file system block, too.
+ *
+ * READ_AHEAD tells a speculative access by the read-ahead thread,
+ * which leaves the replacement state alone, from a demand access.
+ * A speculative access returns NULL if the sector is cached already.
+ */
+static struct buffer_cache_entry_t*
+buffer_cache_acquire (block_sector_t sector, bool exclusive, bool fetch,
+                      bool read_ahead)
+{
+  struct buffer_cache_entry_t *slot, *victim = NULL;
+  bool written_back = false;  // whether the victim had to be written back
+
+  buffer_cache_lock_acquire ();
   while (true) {
-    if (cache[clock].occupied == false) {
-      // found an empty slot -- use it
-      return &(cache[clock]);
+    slot = buffer_cache_lookup (sector);
+    if (slot != NULL) {
+      // cache hit (possibly while someone else is still loading it).
+      if (victim != NULL)
+        buffer_cache_unclaim (victim);
+      if (read_ahead) {
+        // nothing to do
+        lock_release (&buffer_cache_lock);
+        return NULL;
+      }
+      slot->pin_cnt ++;
+      slot->access = true;
+      policy->touch (slot);
+      stats.hits ++;
+      if (slot->read_ahead)
+        stats.read_ahead_used ++;
+      slot->read_ahead = false;
+      lock_release (&buffer_cache_lock);
+
+      buffer_cache_entry_lock (slot, exclusive);
+      return slot;
     }
-    if (cache[clock].access) {
-      // give a second chance
-      cache[clock].access = false;
+
+    if (victim != NULL && victim->pin_cnt > 1) {
+      // somebody wants the old content of the victim back: leave it.
+      buffer_cache_unclaim (victim);
+      victim = NULL;
     }
-    else {
-      // evict 
-      // lock_acquire (&buffer_cache_lock);
-      struct buffer_cache_entry_t *slot = &cache[clock];
-      if (slot->dirty) {
-        // write back into disk
-        block_write (fs_device, slot->disk_sector, slot->buffer);
-        slot->dirty = false;
+
+    if (victim == NULL) {
+      written_back = false;
+      // cache miss: need eviction.
+      victim = buffer_cache_evict ();
+      if (victim == NULL) {
+        cond_wait (&buffer_cache_unpinned, &buffer_cache_lock);
+        continue;
+      }
+      if (victim->occupied && victim->dirty) {
+        // write back into disk, with only the victim locked.
+        victim->in_flight = true;
+        lock_release (&buffer_cache_lock);
+        block_write (fs_device, victim->disk_sector, victim->buffer);
+        victim->dirty = false;
+        buffer_cache_lock_acquire ();
+        victim->in_flight = false;
+        dirty_cnt --;
+        stats.writebacks ++;
+        written_back = true;
+
+        // the sector may have been cached meanwhile: look again.
+        continue;
       }
-      slot->occupied = false;
-      // lock_release (&buffer_cache_lock);
-      return slot;
     }
-    // loop
-    clock ++;
-    clock %= BUFFER_CACHE_SIZE;
+    break;
   }
-  return NULL;
+
+  // fill in the cache entry.
+  slot = victim;
+  if (slot->occupied) {
+    if (written_back)
+      stats.dirty_evictions ++;
+    else
+      stats.clean_evictions ++;
+    buffer_cache_account_drop (slot);
+    policy->remove (slot);
+    hash_delete (&buffer_cache_index, &slot->helem);
+  }
+  slot->occupied = true;
+  slot->disk_sector = sector;
+  slot->dirty = false;
+  slot->access = !read_ahead;
+  slot->read_ahead = read_ahead;
+  hash_insert (&buffer_cache_index, &slot->helem);
+  policy->install (slot);
+  if (read_ahead)
+    stats.read_ahead_issued ++;
+  else
+    stats.misses ++;
+
+  if (fetch) {
+    // concurrent users of this sector wait on the rwlock meanwhile.
+    slot->in_flight = true;
+    lock_release (&buffer_cache_lock);
+    if (fs_block_sectors > 1 && !read_ahead)
+      buffer_cache_fetch_block (slot);
+    else
+      block_read (fs_device, sector, slot->buffer);
+    buffer_cache_lock_acquire ();
+    slot->in_flight = false;
+  }
+  lock_release (&buffer_cache_lock);
+
+  if (!exclusive) {
+    // the content is valid now; let other readers in as well.
+    rw_lock_release_exclusive (&slot->rwlock);
+    rw_lock_acquire_shared (&slot->rwlock);
+  }
+  return slot;
 }
 
-/* read sector and store on buffer, and copy it to target */
-void
-buffer_cache_read (block_sector_t sector, void *target)
+/* Releases SLOT, obtained from buffer_cache_acquire(). */
+static void
+buffer_cache_release (struct buffer_cache_entry_t *slot, bool exclusive)
 {
-  lock_acquire (&buffer_cache_lock);
+  if (exclusive)
+    rw_lock_release_exclusive (&slot->rwlock);
+  else
+    rw_lock_release_shared (&slot->rwlock);
 
-  struct buffer_cache_entry_t *slot = buffer_cache_lookup (sector);
-  if (slot == NULL) {
-    // cache miss: need eviction.
-    slot = buffer_cache_evict ();
-    ASSERT (slot != NULL && slot->occupied == false);
+  buffer_cache_lock_acquire ();
+  ASSERT (slot->pin_cnt > 0);
+  if (-- slot->pin_cnt == 0)
+    cond_signal (&buffer_cache_unpinned, &buffer_cache_lock);
+  lock_release (&buffer_cache_lock);
+}
 
-    // fill in the cache entry.
-    slot->occupied = true;
-    slot->disk_sector = sector;
-    slot->dirty = false;
-    block_read (fs_device, sector, slot->buffer);
+/* Reads the CNT sectors from SECTOR on into SLOTS, the entries
+   claimed for them, skipping null ones (sectors cached already).
+   Each run of consecutive entries is read with one request, by way
+   of BUFFER. */
+static void
+buffer_cache_fill (block_sector_t sector,
+                   struct buffer_cache_entry_t **slots, size_t cnt,
+                   uint8_t (*buffer)[BLOCK_SECTOR_SIZE])
+{
+  size_t i, j;
+
+  for (i = 0; i < cnt; i = j) {
+    if (slots[i] == NULL) {
+      j = i + 1;
+      continue;
+    }
+    for (j = i; j < cnt && slots[j] != NULL; ++ j)
+      continue;
+
+    block_read_multiple (fs_device, sector + i, buffer[i], j - i);
+    for (; i < j; ++ i)
+      memcpy (slots[i]->buffer, buffer[i], BLOCK_SECTOR_SIZE);
   }
+}
 
-  // copy the buffer data into memory.
-  slot->access = true;
-  memcpy (target, slot->buffer, BLOCK_SECTOR_SIZE);
+/* Reads in the sector of SLOT, just installed by a demand miss,
+   together with the other sectors of its file system block that are
+   not cached yet, all with one request as a rule.  A file system
+   block belongs to a single file, so they are likely to be wanted
+   next; they are installed as if read ahead. */
+static void
+buffer_cache_fetch_block (struct buffer_cache_entry_t *slot)
+{
+  static uint8_t buffer[FS_BLOCK_SECTORS_MAX][BLOCK_SECTOR_SIZE];
+  struct buffer_cache_entry_t *slots[FS_BLOCK_SECTORS_MAX];
+  block_sector_t first = ROUND_DOWN (slot->disk_sector, fs_block_sectors);
+  size_t i;
+
+  // claim the missing sectors before the buffer: claiming may wait.
+  for (i = 0; i < fs_block_sectors; ++ i)
+    slots[i] = (first + i == slot->disk_sector ? slot
+                : buffer_cache_acquire (first + i, true, false, true));
+
+  lock_acquire (&fetch_lock);
+  buffer_cache_fill (first, slots, fs_block_sectors, buffer);
+  lock_release (&fetch_lock);
+
+  for (i = 0; i < fs_block_sectors; ++ i)
+    if (slots[i] != NULL && slots[i] != slot)
+      buffer_cache_release (slots[i], true);
+}
+
+/* Marks SLOT, whose rwlock the caller holds exclusively, dirty,
+   waking up the flusher when too many entries have become dirty. */
+static void
+buffer_cache_mark_dirty (struct buffer_cache_entry_t *slot)
+{
+  ASSERT (rw_lock_held_exclusive (&slot->rwlock));
+  if (slot->dirty)
+    return;
+
+  slot->dirty = true;
+  buffer_cache_lock_acquire ();
+  if (++ dirty_cnt == flush_threshold)
+    sema_up (&flush_request);
+  lock_release (&buffer_cache_lock);
+}
+
+/* Returns the entry whose sector data DATA points to. */
+static struct buffer_cache_entry_t*
+buffer_cache_data_to_entry (const void *data)
+{
+  ASSERT (pg_ofs (data) % BLOCK_SECTOR_SIZE == 0);
 
+  // hash lookup : a temporary entry
+  struct buffer_cache_page_t key;
+  key.kpage = pg_round_down (data);
+
+  // the page can't be detached meanwhile, as the entry is pinned.
+  buffer_cache_lock_acquire ();
+  struct hash_elem *h = hash_find (&buffer_cache_pages, &key.helem);
   lock_release (&buffer_cache_lock);
+  ASSERT (h != NULL);
+
+  size_t idx = hash_entry (h, struct buffer_cache_page_t, helem) - cache_pages;
+  return &cache[idx * SECTORS_PER_PAGE + pg_ofs (data) / BLOCK_SECTOR_SIZE];
+}
+
+/* Pins SECTOR in the cache and returns its data, in place.
+   See enum buffer_cache_mode for what the caller may do with it. */
+void *
+buffer_cache_get (block_sector_t sector, enum buffer_cache_mode mode)
+{
+  struct buffer_cache_entry_t *slot;
+
+  switch (mode) {
+    case BUFFER_CACHE_READ:
+      slot = buffer_cache_acquire (sector, false, true, false);
+      break;
+    case BUFFER_CACHE_WRITE:
+      slot = buffer_cache_acquire (sector, true, true, false);
+      break;
+    case BUFFER_CACHE_OVERWRITE:
+      // the whole sector is overwritten, so a miss needs no disk read.
+      slot = buffer_cache_acquire (sector, true, false, false);
+      break;
+    default:
+      NOT_REACHED ();
+  }
+  return slot->buffer;
+}
+
+/* Unpins DATA, obtained from buffer_cache_get().  Data obtained
+   for writing is marked dirty. */
+void
+buffer_cache_put (void *data)
+{
+  struct buffer_cache_entry_t *slot = buffer_cache_data_to_entry (data);
+  bool exclusive = rw_lock_held_exclusive (&slot->rwlock);
+
+  if (exclusive)
+    buffer_cache_mark_dirty (slot);
+  buffer_cache_release (slot, exclusive);
+}
+
+/* read sector and store on buffer, and copy it to target */
+void
+buffer_cache_read (block_sector_t sector, void *target)
+{
+  void *data = buffer_cache_get (sector, BUFFER_CACHE_READ);
+
+  // copy the buffer data into memory.
+  memcpy (target, data, BLOCK_SECTOR_SIZE);
+
+  buffer_cache_put (data);
 }
 
 /* read sector and write source to cache_buffer */
@@ -156,33 +957,242 @@ buffer_cache_write (block_sector_t sector, const void *source)
   #ifdef DEBUG
     printf("in buffer_cache_write\n");
   #endif
-  lock_acquire (&buffer_cache_lock);
+  void *data = buffer_cache_get (sector, BUFFER_CACHE_OVERWRITE);
+
+  // copy the data form memory into the buffer cache.
+  memcpy (data, source, BLOCK_SECTOR_SIZE);
 
-  struct buffer_cache_entry_t *slot = buffer_cache_lookup (sector);
+  buffer_cache_put (data);
   #ifdef DEBUG
-    printf("tem3\n");
+    printf("end buffer_cache_write\n");
   #endif
-  if (slot == NULL) {
-    // cache miss: need eviction.
-    slot = buffer_cache_evict ();
-    // #ifdef DEBUG
-    //   printf("tem3\n");
-    // #endif
-    ASSERT (slot != NULL && slot->occupied == false);
+}
 
-    // fill in the cache entry.
-    slot->occupied = true;
-    slot->disk_sector = sector;
-    slot->dirty = false;
+/* Queues the CNT sectors from SECTOR on to be brought into the cache
+   by the read-ahead thread, and returns without waiting for them.
+   Requests are dropped if too many are pending already. */
+void
+buffer_cache_read_ahead (block_sector_t sector, size_t cnt)
+{
+  lock_acquire (&read_ahead_lock);
+  while (cnt > 0 && read_ahead_cnt < READ_AHEAD_QUEUE_SIZE) {
+    size_t tail = (read_ahead_head + read_ahead_cnt) % READ_AHEAD_QUEUE_SIZE;
+    size_t n = cnt < READ_AHEAD_RUN_MAX ? cnt : READ_AHEAD_RUN_MAX;
+    read_ahead_queue[tail].sector = sector;
+    read_ahead_queue[tail].cnt = n;
+    read_ahead_cnt ++;
+    sector += n;
+    cnt -= n;
+    cond_signal (&read_ahead_nonempty, &read_ahead_lock);
   }
+  lock_release (&read_ahead_lock);
+}
 
-  // copy the data form memory into the buffer cache.
-  slot->access = true;
-  slot->dirty = true;
-  memcpy (slot->buffer, source, BLOCK_SECTOR_SIZE);
+/* Read-ahead thread: loads the queued sectors into the cache, so that
+   the disk latency overlaps with whatever the requester does next.
+   Consecutive sectors missing from the cache are read with a single
+   multi-sector request. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  static uint8_t buffer[READ_AHEAD_RUN_MAX][BLOCK_SECTOR_SIZE];
+  struct buffer_cache_entry_t *slots[READ_AHEAD_RUN_MAX];
+
+  while (true) {
+    lock_acquire (&read_ahead_lock);
+    while (read_ahead_cnt == 0)
+      cond_wait (&read_ahead_nonempty, &read_ahead_lock);
+    struct read_ahead_run run = read_ahead_queue[read_ahead_head];
+    read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE_SIZE;
+    read_ahead_cnt --;
+    lock_release (&read_ahead_lock);
+
+    // claim an entry for each missing sector (hits cost nothing).
+    size_t i;
+    for (i = 0; i < run.cnt; ++ i)
+      slots[i] = buffer_cache_acquire (run.sector + i, true, false, true);
+
+    // read every stretch of missing sectors in one go.
+    buffer_cache_fill (run.sector, slots, run.cnt, buffer);
+    for (i = 0; i < run.cnt; ++ i)
+      if (slots[i] != NULL)
+        buffer_cache_release (slots[i], true);
+  }
+}
+
+/* Orders cache entries by disk sector, for buffer_cache_flush(). */
+static int
+compare_disk_sector (const void *a_, const void *b_)
+{
+  const struct buffer_cache_entry_t *a = *(struct buffer_cache_entry_t * const *) a_;
+  const struct buffer_cache_entry_t *b = *(struct buffer_cache_entry_t * const *) b_;
+  return a->disk_sector < b->disk_sector ? -1 : a->disk_sector > b->disk_sector;
+}
 
+/* Writes every dirty cache entry back to disk, in ascending sector
+   order so that the disk head sweeps once across the disk.  Entries
+   stay cached; readers may keep using them during the write-back. */
+void
+buffer_cache_flush (void)
+{
+  static struct buffer_cache_entry_t **flush_list;
+  size_t flush_cnt = 0, i;
+
+  lock_acquire (&flush_lock);
+  if (flush_list == NULL) {
+    flush_list = malloc (cache_cnt * sizeof *flush_list);
+    if (flush_list == NULL)
+      PANIC ("can't allocate the flush list");
+  }
+
+  // pin the dirty entries, so that they can't be evicted meanwhile.
+  buffer_cache_lock_acquire ();
+  for (i = 0; i < cache_cnt; ++ i)
+  {
+    if (cache[i].occupied && cache[i].dirty) {
+      cache[i].pin_cnt ++;
+      flush_list[flush_cnt ++] = &cache[i];
+    }
+  }
   lock_release (&buffer_cache_lock);
-  #ifdef DEBUG
-    printf("end buffer_cache_write\n");
-  #endif
+
+  qsort (flush_list, flush_cnt, sizeof *flush_list, compare_disk_sector);
+
+  for (i = 0; i < flush_cnt; ++ i)
+  {
+    struct buffer_cache_entry_t *slot = flush_list[i];
+    bool cleaned = false;
+
+    // a shared lock keeps writers out while the data goes to disk.
+    buffer_cache_entry_lock (slot, false);
+    if (slot->dirty) {
+      block_write (fs_device, slot->disk_sector, slot->buffer);
+      slot->dirty = false;
+      cleaned = true;
+    }
+    rw_lock_release_shared (&slot->rwlock);
+
+    buffer_cache_lock_acquire ();
+    if (cleaned) {
+      dirty_cnt --;
+      stats.writebacks ++;
+    }
+    if (-- slot->pin_cnt == 0)
+      cond_signal (&buffer_cache_unpinned, &buffer_cache_lock);
+    lock_release (&buffer_cache_lock);
+  }
+
+  lock_release (&flush_lock);
+}
+
+/* Flusher thread: writes dirty entries back whenever it is requested
+   to, either by the flush timer or by a writer crossing the threshold. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  while (true) {
+    sema_down (&flush_request);
+    // requests that piled up meanwhile are served by this round as well.
+    while (sema_try_down (&flush_request))
+      continue;
+    buffer_cache_flush ();
+  }
+}
+
+/* Flush timer thread: requests a flush every flush_interval ticks. */
+static void
+flush_timer_daemon (void *aux UNUSED)
+{
+  while (true) {
+    timer_sleep (flush_interval);
+    sema_up (&flush_request);
+  }
+}
+
+/* Returns true if the page IDX may be detached right now: none of
+   its entries is pinned or dirty. */
+static bool
+buffer_cache_page_reclaimable (size_t idx)
+{
+  size_t i;
+  for (i = 0; i < SECTORS_PER_PAGE; ++ i)
+  {
+    struct buffer_cache_entry_t *e = &cache[idx * SECTORS_PER_PAGE + i];
+    if (e->pin_cnt > 0 || (e->occupied && e->dirty))
+      return false;
+  }
+  return true;
+}
+
+/* Drops the content of the page IDX and gives it back to the page
+   allocator. */
+static void
+buffer_cache_detach_page (size_t idx)
+{
+  struct buffer_cache_page_t *page = &cache_pages[idx];
+  size_t i;
+
+  for (i = 0; i < SECTORS_PER_PAGE; ++ i)
+  {
+    struct buffer_cache_entry_t *e = &cache[idx * SECTORS_PER_PAGE + i];
+    if (e->occupied) {
+      buffer_cache_account_drop (e);
+      policy->remove (e);
+      hash_delete (&buffer_cache_index, &e->helem);
+    }
+    else
+      list_remove (&e->lelem);    // unpinned and unoccupied: on the free list
+    e->occupied = false;
+    e->buffer = NULL;
+  }
+
+  hash_delete (&buffer_cache_pages, &page->helem);
+  palloc_free_page (page->kpage);
+  page->kpage = NULL;
+  cache_pages_attached --;
+}
+
+/**
+ * Gives up to PAGE_CNT pages of clean, unpinned cache entries back to
+ * the user pool, when user processes are short of frames.  Returns the
+ * number of pages freed.  If dirty entries are in the way, the flusher
+ * is woken up, so that they are clean by the next call.
+ */
+size_t
+buffer_cache_shrink (size_t page_cnt)
+{
+  static size_t hand = 0;   // clock hand over the pages
+  size_t freed = 0, it;
+
+  buffer_cache_lock_acquire ();
+  for (it = 0; it < 2 * cache_page_cnt && freed < page_cnt; ++ it) {
+    size_t idx = hand;
+    hand = (hand + 1) % cache_page_cnt;
+
+    if (cache_pages[idx].kpage == NULL
+        || !buffer_cache_page_reclaimable (idx))
+      continue;
+    if ((cache_pages_attached - 1) * SECTORS_PER_PAGE < BUFFER_CACHE_SIZE_MIN)
+      break;
+
+    // give recently used pages a second chance
+    bool accessed = false;
+    size_t i;
+    for (i = 0; i < SECTORS_PER_PAGE; ++ i)
+    {
+      struct buffer_cache_entry_t *e = &cache[idx * SECTORS_PER_PAGE + i];
+      accessed = accessed || e->access;
+      e->access = false;
+    }
+    if (accessed)
+      continue;
+
+    buffer_cache_detach_page (idx);
+    freed ++;
+  }
+  if (freed < page_cnt && dirty_cnt > 0)
+    sema_up (&flush_request);
+  lock_release (&buffer_cache_lock);
+
+  return freed;
 }
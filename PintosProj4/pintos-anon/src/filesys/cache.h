@@ -3,10 +3,55 @@
 
 #include "devices/block.h"
 
+struct cache_stats;
+
 /* Buffer Caches. */
 
+/* How the data returned by buffer_cache_get() is going to be used. */
+enum buffer_cache_mode
+  {
+    BUFFER_CACHE_READ,          /* Read only; other readers share it. */
+    BUFFER_CACHE_WRITE,         /* Read and modified, exclusively. */
+    BUFFER_CACHE_OVERWRITE      /* Entirely overwritten, exclusively;
+                                   the old content is not read in. */
+  };
+
 void buffer_cache_init (void);
 void buffer_cache_close (void);
+void buffer_cache_print_stats (void);
+void buffer_cache_get_stats (struct cache_stats *);
+
+/* Cache size and write-behind configuration, set from the kernel
+   command line. */
+void buffer_cache_set_size (size_t cnt);
+bool buffer_cache_set_policy (const char *name);
+void buffer_cache_set_flush_interval (int64_t ticks);
+void buffer_cache_set_flush_threshold (size_t cnt);
+
+/**
+ * Writes all dirty cache entries back to the disk.
+ */
+void buffer_cache_flush (void);
+
+/**
+ * Pins the disk sector specified by `sector` in the cache, and returns
+ * a pointer to its BLOCK_SECTOR_SIZE bytes of cached data, which the
+ * caller accesses in place according to `mode`.  Must be paired with
+ * buffer_cache_put().
+ */
+void *buffer_cache_get (block_sector_t sector, enum buffer_cache_mode mode);
+
+/**
+ * Unpins `data`, a pointer returned by buffer_cache_get().  Data pinned
+ * for writing or overwriting is written back to the disk later on.
+ */
+void buffer_cache_put (void *data);
+
+/**
+ * Frees up to `page_cnt` pages of clean cache data into the user pool,
+ * and returns how many pages were freed.
+ */
+size_t buffer_cache_shrink (size_t page_cnt);
 
 /**
  * Read SECTOR_SIZE bytes of data starting from the disk sector
@@ -20,4 +65,10 @@ void buffer_cache_read (block_sector_t sector, void *target);
  */
 void buffer_cache_write (block_sector_t sector, const void *source);
 
+/**
+ * Asynchronously brings the `cnt` disk sectors starting at `sector`
+ * into the cache, if they are not cached yet.  Never blocks on disk I/O.
+ */
+void buffer_cache_read_ahead (block_sector_t sector, size_t cnt);
+
 #endif
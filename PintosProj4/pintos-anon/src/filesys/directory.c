@@ -1,10 +1,14 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <dirent.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 
 // #define DEBUG
@@ -22,14 +26,212 @@ struct dir_entry
     block_sector_t inode_sector;        /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
     bool in_use;                        /* In use or free? */
+    bool is_dir;                        /* Names a directory? */
   };
 
+/* Hashed directory index.
+
+   A directory that grows past DIR_INDEX_MIN entries gets an index, so
+   that a name is found with a few sector reads instead of a scan.
+   The entries stay where they are, so the directory still reads
+   correctly as a plain array of them, and it can do without the index
+   whenever the index cannot be kept up to date.
+
+   The index is a file of its own, whose inode the directory's inode
+   points to (see inode_dir_index()): a header sector followed by
+   bucket_cnt buckets of one sector each.  A name that hashes to H is
+   listed in bucket H % bucket_cnt along with its slot, the position
+   of its entry in the directory.  Unused slots are chained through
+   their inode_sector members, so that dir_add() need not look for
+   one.  Slot 0 holds the parent directory and is never listed. */
+#define DIR_INDEX_MIN 64
+#define DIR_INDEX_MAGIC 0x48444958      /* Identifies an index. */
+#define BUCKET_ENTRIES 63
+
+/* Header, the first sector of the index. */
+struct index_header
+  {
+    uint32_t magic;                     /* DIR_INDEX_MAGIC. */
+    uint32_t bucket_cnt;                /* Number of buckets. */
+    uint32_t entry_cnt;                 /* Names listed. */
+    uint32_t free_slot;                 /* First unused slot, or 0. */
+  };
+
+/* Bucket, one sector long. */
+struct index_bucket
+  {
+    uint32_t cnt;                       /* Entries in use. */
+    struct
+      {
+        uint32_t hash;                  /* hash_string() of the name. */
+        uint32_t slot;                  /* Where its entry is. */
+      }
+    entries[BUCKET_ENTRIES];
+    uint32_t unused;
+  };
+
+/* An open index. */
+struct dir_index
+  {
+    struct inode *inode;                /* Index file. */
+    struct index_header header;         /* Copy of its header. */
+  };
+
+/* Dentry cache: the results of recent lookups, misses included, keyed
+   by directory (inode sector) and name, so that walking a hot path
+   takes neither a directory scan nor disk access.  Entries are looked
+   up, filled in and changed by dir_add() and dir_remove() under the
+   directory's lock.  At most DCACHE_MAX of them are kept. */
+#define DCACHE_MAX 256
+
+struct dentry
+  {
+    struct hash_elem helem;             /* Element in dcache. */
+    struct list_elem lelem;             /* Element in dcache_lru. */
+    block_sector_t parent;              /* Directory looked in. */
+    char name[NAME_MAX + 1];            /* Name looked up. */
+    block_sector_t inode_sector;        /* What it names, or -1 if none. */
+  };
+
+static struct hash dcache;
+static struct list dcache_lru;          /* Most recently used first. */
+static size_t dcache_cnt;
+static struct lock dcache_lock;         /* Protects the above. */
+
+// Hash Functions required for [dcache]. Uses 'parent' and 'name' as key.
+static unsigned
+dentry_hash_func (const struct hash_elem *elem, void *aux UNUSED)
+{
+  struct dentry *d = hash_entry (elem, struct dentry, helem);
+  return hash_int ((int) d->parent) ^ hash_string (d->name);
+}
+
+static bool
+dentry_less_func (const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  struct dentry *a_d = hash_entry (a, struct dentry, helem);
+  struct dentry *b_d = hash_entry (b, struct dentry, helem);
+  if (a_d->parent != b_d->parent)
+    return a_d->parent < b_d->parent;
+  return strcmp (a_d->name, b_d->name) < 0;
+}
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  if (!hash_init (&dcache, dentry_hash_func, dentry_less_func, NULL))
+    PANIC ("dentry cache creation failed");
+  list_init (&dcache_lru);
+  dcache_cnt = 0;
+  lock_init (&dcache_lock);
+}
+
+/* Returns the cached dentry for NAME in directory PARENT, or a null
+   pointer.  The caller must hold dcache_lock. */
+static struct dentry *
+dcache_find (block_sector_t parent, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache, &key.helem);
+  return e != NULL ? hash_entry (e, struct dentry, helem) : NULL;
+}
+
+/* Looks up NAME in directory PARENT in the dentry cache.  Returns
+   true if it is there, setting *SECTORP to the inode sector NAME
+   stands for, or to -1 if it is known not to exist. */
+static bool
+dcache_get (block_sector_t parent, const char *name, block_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+  lock_acquire (&dcache_lock);
+  d = dcache_find (parent, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lelem);
+      list_push_front (&dcache_lru, &d->lelem);
+      *sectorp = d->inode_sector;
+    }
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in directory PARENT stands for inode sector
+   SECTOR, or that it does not exist if SECTOR is -1. */
+static void
+dcache_set (block_sector_t parent, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+  lock_acquire (&dcache_lock);
+  d = dcache_find (parent, name);
+  if (d != NULL)
+    list_remove (&d->lelem);
+  else
+    {
+      if (dcache_cnt >= DCACHE_MAX)
+        {
+          // reuse the least recently used entry
+          d = list_entry (list_pop_back (&dcache_lru), struct dentry, lelem);
+          hash_delete (&dcache, &d->helem);
+          dcache_cnt--;
+        }
+      else
+        d = malloc (sizeof *d);
+      if (d == NULL)
+        {
+          lock_release (&dcache_lock);
+          return;
+        }
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dcache, &d->helem);
+      dcache_cnt++;
+    }
+  d->inode_sector = sector;
+  list_push_front (&dcache_lru, &d->lelem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every name cached for directory PARENT, whose sector is
+   about to be reused. */
+static void
+dcache_purge (block_sector_t parent)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&dcache_lru); e != list_end (&dcache_lru); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lelem);
+      next = list_next (e);
+      if (d->parent == parent)
+        {
+          list_remove (&d->lelem);
+          hash_delete (&dcache, &d->helem);
+          dcache_cnt--;
+          free (d);
+        }
+    }
+  lock_release (&dcache_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the given SECTOR.
    Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
   bool success = true;
+  dcache_purge (sector);
   success = inode_create (sector, entry_cnt * sizeof (struct dir_entry), /*is_dir*/ true);
   if(!success) return false;
 
@@ -38,6 +240,7 @@ dir_create (block_sector_t sector, size_t entry_cnt)
   struct dir *dir = dir_open( inode_open(sector) );
   ASSERT (dir != NULL);
   struct dir_entry e;
+  memset (&e, 0, sizeof e);
   e.inode_sector = sector;
   if (inode_write_at(dir->inode, &e, sizeof e, 0) != sizeof e) {
     success = false;
@@ -111,21 +314,306 @@ int dir_tell(const struct dir *dir) {
 }
 
 
+/* Opens the index of directory DIR_INODE into *IDX.  Returns false
+   if the directory has none. */
+static bool
+index_open (struct inode *dir_inode, struct dir_index *idx)
+{
+  block_sector_t sector = inode_dir_index (dir_inode);
+
+  if (sector == 0)
+    return false;
+  idx->inode = inode_open (sector);
+  if (idx->inode == NULL)
+    return false;
+  if (inode_read_at (idx->inode, &idx->header, sizeof idx->header, 0)
+      != sizeof idx->header || idx->header.magic != DIR_INDEX_MAGIC)
+    {
+      inode_close (idx->inode);
+      return false;
+    }
+  return true;
+}
+
+/* Closes IDX. */
+static void
+index_close (struct dir_index *idx)
+{
+  inode_close (idx->inode);
+}
+
+/* Writes the header of IDX back.  Returns false on failure. */
+static bool
+index_write_header (struct dir_index *idx)
+{
+  return (inode_write_at (idx->inode, &idx->header, sizeof idx->header, 0)
+          == sizeof idx->header);
+}
+
+/* Returns the offset in IDX of the bucket for names hashing to HASH. */
+static off_t
+bucket_ofs (const struct dir_index *idx, unsigned hash)
+{
+  return (1 + hash % idx->header.bucket_cnt) * BLOCK_SECTOR_SIZE;
+}
+
+/* Reads the bucket of IDX for HASH into a new buffer, and returns it
+   (to be freed by the caller), or a null pointer on failure. */
+static struct index_bucket *
+bucket_read (const struct dir_index *idx, unsigned hash)
+{
+  struct index_bucket *b = malloc (sizeof *b);
+
+  if (b != NULL
+      && inode_read_at (idx->inode, b, sizeof *b, bucket_ofs (idx, hash))
+         != sizeof *b)
+    {
+      free (b);
+      b = NULL;
+    }
+  return b;
+}
+
+/* Writes B back as the bucket of IDX for HASH, and frees it.
+   Returns false on failure. */
+static bool
+bucket_write (const struct dir_index *idx, unsigned hash,
+              struct index_bucket *b)
+{
+  bool success = (inode_write_at (idx->inode, b, sizeof *b,
+                                  bucket_ofs (idx, hash)) == sizeof *b);
+  free (b);
+  return success;
+}
+
+/* Lists SLOT, whose name hashes to HASH, in IDX.  Returns false if
+   its bucket is full or on failure. */
+static bool
+index_insert (struct dir_index *idx, unsigned hash, uint32_t slot)
+{
+  struct index_bucket *b = bucket_read (idx, hash);
+
+  if (b == NULL)
+    return false;
+  if (b->cnt >= BUCKET_ENTRIES)
+    {
+      free (b);
+      return false;
+    }
+  b->entries[b->cnt].hash = hash;
+  b->entries[b->cnt].slot = slot;
+  b->cnt++;
+  return bucket_write (idx, hash, b);
+}
+
+/* Takes SLOT, whose name hashes to HASH, off IDX.  Returns false on
+   failure. */
+static bool
+index_delete (struct dir_index *idx, unsigned hash, uint32_t slot)
+{
+  struct index_bucket *b = bucket_read (idx, hash);
+  size_t i;
+
+  if (b == NULL)
+    return false;
+  for (i = 0; i < b->cnt; i++)
+    if (b->entries[i].slot == slot)
+      {
+        b->entries[i] = b->entries[--b->cnt];
+        return bucket_write (idx, hash, b);
+      }
+  free (b);
+  return false;
+}
+
+/* Looks NAME up through IDX, the index of DIR_INODE.  Returns its
+   slot and stores its entry into *EP if found, otherwise 0. */
+static uint32_t
+index_find (struct dir_index *idx, struct inode *dir_inode,
+            const char *name, struct dir_entry *ep)
+{
+  unsigned hash = hash_string (name);
+  struct index_bucket *b = bucket_read (idx, hash);
+  uint32_t slot = 0;
+  size_t i;
+
+  if (b == NULL)
+    return 0;
+  for (i = 0; i < b->cnt && slot == 0; i++)
+    if (b->entries[i].hash == hash
+        && inode_read_at (dir_inode, ep, sizeof *ep,
+                          b->entries[i].slot * sizeof *ep) == sizeof *ep
+        && ep->in_use && !strcmp (name, ep->name))
+      slot = b->entries[i].slot;
+  free (b);
+  return slot;
+}
+
+/* Does away with the index of directory DIR_INODE, if any. */
+static void
+index_drop (struct inode *dir_inode)
+{
+  block_sector_t sector = inode_dir_index (dir_inode);
+
+  if (sector != 0)
+    {
+      struct inode *inode = inode_open (sector);
+      inode_set_dir_index (dir_inode, 0);
+      if (inode != NULL)
+        {
+          inode_remove (inode);
+          inode_close (inode);
+        }
+    }
+}
+
+/* Creates an index of BUCKET_CNT buckets for the first SLOT_CNT slots
+   of directory DIR_INODE, chaining the unused ones.  Returns the
+   sector of its inode, or 0 if a bucket overflowed or the disk is
+   full. */
+static block_sector_t
+index_fill (struct inode *dir_inode, size_t slot_cnt, size_t bucket_cnt)
+{
+  struct dir_index idx;
+  struct dir_entry e;
+  block_sector_t sector;
+  size_t cnt, slot;
+  bool success = true;
+
+  // the buckets are holes, that is, empty, to start with.
+  if (!free_map_allocate_extent (1, 1, inode_get_inumber (dir_inode),
+                                 &sector, &cnt))
+    return 0;
+  free_map_flush ();
+  if (!inode_create (sector, (1 + bucket_cnt) * BLOCK_SECTOR_SIZE, false)
+      || (idx.inode = inode_open (sector)) == NULL)
+    {
+      free_map_release (sector, 1);
+      free_map_flush ();
+      return 0;
+    }
+  idx.header.magic = DIR_INDEX_MAGIC;
+  idx.header.bucket_cnt = bucket_cnt;
+  idx.header.entry_cnt = 0;
+  idx.header.free_slot = 0;
+
+  // backwards, so that the unused slots are chained in order.
+  for (slot = slot_cnt - 1; success && slot > 0; slot--)
+    {
+      off_t ofs = slot * sizeof e;
+      if (inode_read_at (dir_inode, &e, sizeof e, ofs) != sizeof e)
+        success = false;
+      else if (e.in_use)
+        {
+          success = index_insert (&idx, hash_string (e.name), slot);
+          idx.header.entry_cnt++;
+        }
+      else
+        {
+          e.inode_sector = idx.header.free_slot;
+          idx.header.free_slot = slot;
+          success = inode_write_at (dir_inode, &e, sizeof e, ofs) == sizeof e;
+        }
+    }
+  success = success && index_write_header (&idx);
+
+  if (!success)
+    inode_remove (idx.inode);
+  inode_close (idx.inode);
+  return success ? sector : 0;
+}
+
+/* (Re)builds the index of directory DIR_INODE, with about twice as
+   many bucket entries as the directory has slots.  If that fails,
+   even with more buckets, the directory is left without an index. */
+static void
+index_build (struct inode *dir_inode)
+{
+  size_t slot_cnt = inode_length (dir_inode) / sizeof (struct dir_entry);
+  size_t bucket_cnt = 4;
+  int attempt;
+
+  index_drop (dir_inode);
+  while (bucket_cnt * BUCKET_ENTRIES < 2 * slot_cnt)
+    bucket_cnt *= 2;
+  for (attempt = 0; attempt < 3; attempt++, bucket_cnt *= 2)
+    {
+      block_sector_t sector = index_fill (dir_inode, slot_cnt, bucket_cnt);
+      if (sector != 0)
+        {
+          inode_set_dir_index (dir_inode, sector);
+          return;
+        }
+    }
+}
+
+/* Adds an entry for NAME and INODE_SECTOR, a directory if IS_DIR, to
+   directory DIR_INODE, in the first unused slot or else at the end,
+   and lists it in IDX, its index.  Rebuilds the index with more
+   buckets when it fills up.  Returns false if the entry could not be
+   written. */
+static bool
+index_add (struct dir_index *idx, struct inode *dir_inode,
+           const char *name, block_sector_t inode_sector, bool is_dir)
+{
+  struct dir_entry e;
+  uint32_t slot = idx->header.free_slot;
+
+  if (slot != 0)
+    {
+      if (inode_read_at (dir_inode, &e, sizeof e, slot * sizeof e)
+          != sizeof e)
+        return false;
+      idx->header.free_slot = e.inode_sector;
+    }
+  else
+    slot = inode_length (dir_inode) / sizeof e;
+
+  e.in_use = true;
+  e.is_dir = is_dir;
+  strlcpy (e.name, name, sizeof e.name);
+  e.inode_sector = inode_sector;
+  if (inode_write_at (dir_inode, &e, sizeof e, slot * sizeof e) != sizeof e)
+    return false;
+
+  idx->header.entry_cnt++;
+  if (idx->header.entry_cnt > idx->header.bucket_cnt * BUCKET_ENTRIES * 3 / 4
+      || !index_insert (idx, hash_string (name), slot)
+      || !index_write_header (idx))
+    index_build (dir_inode);
+  return true;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   The caller must hold DIR's lock (see inode_dir_lock()). */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
+  struct dir_index idx;
   size_t ofs;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (index_open (dir->inode, &idx))
+    {
+      uint32_t slot = index_find (&idx, dir->inode, name, &e);
+      index_close (&idx);
+      if (slot == 0)
+        return false;
+      if (ep != NULL)
+        *ep = e;
+      if (ofsp != NULL)
+        *ofsp = slot * sizeof e;
+      return true;
+    }
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -148,25 +636,37 @@ dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode)
 {
   struct dir_entry e;
+  block_sector_t parent, sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  parent = inode_get_inumber (dir->inode);
+  inode_dir_lock (dir->inode);
   if (strcmp (name, ".") == 0) {
     // current directory
     *inode = inode_reopen (dir->inode);
   }
+  else if (dcache_get (parent, name, &sector)) {
+    // seen lately, whether found or not
+    *inode = sector != -1u ? inode_open (sector) : NULL;
+  }
   else if (strcmp (name, "..") == 0) {
     // parent directory : the information is stored at the first (0-pos) entry.
     inode_read_at (dir->inode, &e, sizeof e, 0);
+    dcache_set (parent, name, e.inode_sector);
     *inode = inode_open (e.inode_sector);
   }
   else if (lookup (dir, name, &e, NULL)) {
     // normal lookup. lookuped entry is stored into e
+    dcache_set (parent, name, e.inode_sector);
     *inode = inode_open (e.inode_sector);
   }
-  else
+  else {
+    dcache_set (parent, name, -1u);
     *inode = NULL;
+  }
+  inode_dir_unlock (dir->inode);
 
   return *inode != NULL;
 }
@@ -181,6 +681,7 @@ bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is_dir)
 {
   struct dir_entry e;
+  struct dir_index idx;
   off_t ofs;
   bool success = false;
 
@@ -191,7 +692,11 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
+  /* Check that NAME is not in use, and DIR is not being removed, as
+     one step with adding it. */
+  inode_dir_lock (dir->inode);
+  if (inode_is_removed (dir->inode))
+    goto done;
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
@@ -206,9 +711,17 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is
       dir_close (child_dir);
       goto done;
     }
+    dcache_set (inode_sector, "..", e.inode_sector);
     dir_close (child_dir);
   }
 
+  if (index_open (dir->inode, &idx))
+    {
+      success = index_add (&idx, dir->inode, name, inode_sector, is_dir);
+      index_close (&idx);
+      goto done;
+    }
+
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
      current end-of-file.
@@ -223,23 +736,38 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is
 
   /* Write slot. */
   e.in_use = true;
+  e.is_dir = is_dir;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success && ofs / sizeof e >= DIR_INDEX_MIN)
+    index_build (dir->inode);
 
  done:
+  if (success)
+    dcache_set (inode_get_inumber (dir->inode), name, inode_sector);
+  inode_dir_unlock (dir->inode);
   return success;
 }
 
-/* Returns whether the DIR is empty. */
-bool
-dir_is_empty (const struct dir *dir)
+/* Returns whether the directory INODE has no entries.
+   The caller must hold its lock. */
+static bool
+is_empty (struct inode *inode)
 {
   struct dir_entry e;
+  struct dir_index idx;
   off_t ofs;
 
+  if (index_open (inode, &idx))
+    {
+      bool empty = idx.header.entry_cnt == 0;
+      index_close (&idx);
+      return empty;
+    }
+
   for (ofs = sizeof e; /* 0-pos is for parent directory */
-       inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+       inode_read_at (inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e)
   {
     if (e.in_use)
@@ -248,6 +776,18 @@ dir_is_empty (const struct dir *dir)
   return true;
 }
 
+/* Returns whether the DIR is empty. */
+bool
+dir_is_empty (const struct dir *dir)
+{
+  bool empty;
+
+  inode_dir_lock (dir->inode);
+  empty = is_empty (dir->inode);
+  inode_dir_unlock (dir->inode);
+  return empty;
+}
+
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
    which occurs only if there is no file with the given NAME. */
@@ -255,7 +795,10 @@ bool
 dir_remove (struct dir *dir, const char *name) 
 {
   struct dir_entry e;
+  struct dir_index idx;
   struct inode *inode = NULL;
+  bool indexed = false;
+  bool target_locked = false;
   bool success = false;
   off_t ofs;
 
@@ -263,6 +806,7 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
+  inode_dir_lock (dir->inode);
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
@@ -271,25 +815,46 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
-  /* Prevent removing non-empty directory. */
+  /* Prevent removing non-empty directory.  Its lock (always taken
+     after its parent's) is held until it is marked removed, so that
+     nothing can be added to it meanwhile. */
   if (inode_is_directory (inode)) {
-    // target : the directory to be removed. (dir : the base directory)
-    struct dir *target = dir_open (inode);
-    bool is_empty = dir_is_empty (target);
-    dir_close (target);
-    if (! is_empty) goto done; // can't delete
+    inode_dir_lock (inode);
+    target_locked = true;
+    if (! is_empty (inode)) goto done; // can't delete
   }
 
-  /* Erase directory entry. */
+  /* Erase directory entry, and take it off the index. */
+  indexed = index_open (dir->inode, &idx);
   e.in_use = false;
+  if (indexed)
+    e.inode_sector = idx.header.free_slot;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  if (indexed)
+    {
+      idx.header.free_slot = ofs / sizeof e;
+      idx.header.entry_cnt--;
+      if (!index_delete (&idx, hash_string (name), ofs / sizeof e)
+          || !index_write_header (&idx))
+        index_drop (dir->inode);
+    }
 
-  /* Remove inode. */
+  /* Remove inode, and the index of a directory. */
   inode_remove (inode);
+  dcache_set (inode_get_inumber (dir->inode), name, -1u);
+  if (target_locked) {
+    index_drop (inode);
+    dcache_purge (inode_get_inumber (inode));
+  }
   success = true;
 
  done:
+  if (indexed)
+    index_close (&idx);
+  if (target_locked)
+    inode_dir_unlock (inode);
+  inode_dir_unlock (dir->inode);
   inode_close (inode);
   return success;
 }
@@ -301,15 +866,47 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool found = false;
 
+  inode_dir_lock (dir->inode);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
       if (e.in_use && strcmp(e.name, ".") != 0 && strcmp(e.name, "..") != 0)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          found = true;
+          break;
         } 
     }
-  return false;
+  inode_dir_unlock (dir->inode);
+  return found;
+}
+
+/* Reads up to CNT entries of DIR, from where dir_readdir() would go
+   on, into ENTRIES, with their inode numbers and types.  The types
+   are recorded in the entries themselves, so no inode is opened.
+   Returns how many were read, fewer than CNT only at the end of the
+   directory. */
+size_t
+dir_getdents (struct dir *dir, struct dirent *entries, size_t cnt)
+{
+  struct dir_entry e;
+  size_t n = 0;
+
+  inode_dir_lock (dir->inode);
+  while (n < cnt
+         && inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
+    {
+      dir->pos += sizeof e;
+      if (e.in_use && strcmp(e.name, ".") != 0 && strcmp(e.name, "..") != 0)
+        {
+          entries[n].inumber = e.inode_sector;
+          entries[n].is_dir = e.is_dir;
+          strlcpy (entries[n].name, e.name, sizeof entries[n].name);
+          n++;
+        }
+    }
+  inode_dir_unlock (dir->inode);
+  return n;
 }
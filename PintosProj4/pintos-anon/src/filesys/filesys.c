@@ -13,8 +13,27 @@
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* Sectors per file system block.  Set from the kernel command line
+   for formatting, and read back from the free map inode otherwise. */
+size_t fs_block_sectors = 1;
+
 static void do_format (void);
 
+/* Makes a file system formatted from now on use blocks of SIZE
+   bytes, a power of 2 from BLOCK_SECTOR_SIZE to 8 kB.  Returns false
+   if SIZE is not one of those. */
+bool
+filesys_set_block_size (size_t size)
+{
+  size_t sectors = size / BLOCK_SECTOR_SIZE;
+
+  if (size % BLOCK_SECTOR_SIZE != 0 || sectors == 0
+      || sectors > FS_BLOCK_SECTORS_MAX || (sectors & (sectors - 1)) != 0)
+    return false;
+  fs_block_sectors = sectors;
+  return true;
+}
+
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
 void
@@ -25,6 +44,7 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  dir_init ();
   free_map_init ();
   buffer_cache_init ();
   if (format) 
@@ -38,6 +58,8 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  inode_flush_all ();
+  inode_reclaim_wait ();
   free_map_close ();
   buffer_cache_close ();
 }
@@ -62,13 +84,17 @@ filesys_create (const char *path, off_t initial_size, bool is_dir)
   char *file_name;
   parse_to_get_dir_filename(path, &dir, &file_name);
 
+  // put the inode near its directory's
+  block_sector_t goal = dir != NULL ? inode_get_inumber (dir_get_inode (dir)) : 0;
+  size_t cnt;
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate_extent (1, 1, goal, &inode_sector, &cnt)
                   && inode_create (inode_sector, initial_size, is_dir)
                   && dir_add (dir, file_name, inode_sector, is_dir));
 
   if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
+  free_map_flush ();
   dir_close (dir);
 
   return success;
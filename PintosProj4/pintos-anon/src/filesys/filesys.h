@@ -2,6 +2,7 @@
 #define FILESYS_FILESYS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 
 /* Sectors of system file inodes. */
@@ -11,6 +12,12 @@
 /* Block device that contains the file system. */
 struct block *fs_device;
 
+/* Sectors per file system block, the unit in which sectors are
+   allocated: a power of 2, chosen when formatting. */
+extern size_t fs_block_sectors;
+#define FS_BLOCK_SECTORS_MAX 16 /* Largest fs_block_sectors (8 kB). */
+
+bool filesys_set_block_size (size_t size);
 void filesys_init (bool format);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size, bool is_dir);
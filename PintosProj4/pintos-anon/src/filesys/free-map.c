@@ -1,72 +1,438 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 // #define DEBUG
+
+/* The free map has one bit per file system block of fs_block_sectors
+   sectors.  Its interface is in sectors all the same: a request is
+   rounded up to whole blocks, and so is the run it returns. */
+
+/* Number of blocks whose bits share one sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Blocks per block group: the allocator keeps a free count for
+   each group, and skips groups that cannot satisfy a request. */
+#define GROUP_BLOCKS BITS_PER_SECTOR
+
+/* Number of blocks needed for CNT sectors.
+
+   Every allocation is rounded up here, single-sector ones included:
+   an inode, an extent tree node or an index sector takes a whole
+   block.  With -block-size above 512 bytes, each of them wastes
+   fs_block_sectors - 1 sectors, e.g. 3.5 kB per file at 4 kB blocks.
+   That is the price of one bit per block in the free map. */
+#define SECTORS_TO_BLOCKS(CNT) DIV_ROUND_UP (CNT, fs_block_sectors)
+
 static struct file *free_map_file;   /* Free map file. */
-static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *free_map;      /* Free map, one bit per block. */
+
+/* Sectors of the free map file changed since the last
+   free_map_flush(), one bit per sector of the file. */
+static struct bitmap *free_map_dirty;
+
+/* Protects the free map, the dirty map and the counts below. */
+static struct lock free_map_lock;
+
+static size_t group_cnt;             /* Number of block groups. */
+static size_t *group_free;           /* Free blocks in each group. */
+static size_t free_cnt;              /* Free blocks in all. */
+static size_t reserved_cnt;          /* ...promised by free_map_reserve(). */
+
+/* Recomputes the free count of each block group from the free map. */
+static void
+free_map_count_groups (void)
+{
+  size_t block_cnt = bitmap_size (free_map);
+  size_t g;
+  free_cnt = 0;
+  for (g = 0; g < group_cnt; g++)
+    {
+      size_t start = g * GROUP_BLOCKS;
+      size_t cnt = block_cnt - start < GROUP_BLOCKS
+                   ? block_cnt - start : GROUP_BLOCKS;
+      group_free[g] = bitmap_count (free_map, start, cnt, false);
+      free_cnt += group_free[g];
+    }
+}
+
+/* Updates the group free counts for the CNT blocks from BLOCK on,
+   which were just marked USED (or free). */
+static void
+free_map_account (size_t block, size_t cnt, bool used)
+{
+  if (used)
+    free_cnt -= cnt;
+  else
+    free_cnt += cnt;
+  while (cnt > 0)
+    {
+      size_t g = block / GROUP_BLOCKS;
+      size_t n = (g + 1) * GROUP_BLOCKS - block;
+      if (n > cnt)
+        n = cnt;
+      if (used)
+        group_free[g] -= n;
+      else
+        group_free[g] += n;
+      block += n;
+      cnt -= n;
+    }
+}
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
-  free_map = bitmap_create (block_size (fs_device));
+  lock_init (&free_map_lock);
+}
+
+/* Creates the (empty) free map for blocks of fs_block_sectors
+   sectors, which is known only once the file system is formatted or
+   its free map inode is read. */
+static void
+free_map_setup (void)
+{
+  if (free_map != NULL)
+    {
+      bitmap_destroy (free_map);
+      bitmap_destroy (free_map_dirty);
+      free (group_free);
+    }
+
+  free_map = bitmap_create (block_size (fs_device) / fs_block_sectors);
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
-  bitmap_mark (free_map, FREE_MAP_SECTOR);
-  bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, FREE_MAP_SECTOR / fs_block_sectors);
+  bitmap_mark (free_map, ROOT_DIR_SECTOR / fs_block_sectors);
+
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                                BLOCK_SECTOR_SIZE));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_BLOCKS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("can't allocate block group counts");
+  free_map_count_groups ();
+}
+
+/* Records that the bits of the CNT blocks from BLOCK on changed. */
+static void
+free_map_mark_dirty (size_t block, size_t cnt)
+{
+  size_t first = block / BITS_PER_SECTOR;
+  size_t last = (block + cnt - 1) / BITS_PER_SECTOR;
+  bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
+/* Writes the parts of the free map changed since the last call
+   to the free map file, one run of file sectors at a time.  Called
+   at the end of each file system operation that allocates or frees
+   sectors, so that the file (in the buffer cache) is just as up to
+   date as when it was rewritten as a whole on every change.
+   Returns false if the free map file could not be written. */
+bool
+free_map_flush (void)
+{
+  size_t sector_cnt = bitmap_size (free_map_dirty);
+  size_t start = 0;
+  bool success = true;
+
+  if (free_map_file == NULL)
+    return true;
+  lock_acquire (&free_map_lock);
+  while ((start = bitmap_scan (free_map_dirty, start, 1, true))
+         != BITMAP_ERROR)
+    {
+      size_t end = bitmap_scan (free_map_dirty, start, 1, false);
+      if (end == BITMAP_ERROR)
+        end = sector_cnt;
+      bitmap_set_multiple (free_map_dirty, start, end - start, false);
+      if (!bitmap_write_partial (free_map, free_map_file,
+                                 start * BLOCK_SECTOR_SIZE,
+                                 (end - start) * BLOCK_SECTOR_SIZE))
+        success = false;
+      start = end;
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Returns the number of free blocks from BLOCK on, counting at
+   most MAX of them. */
+static size_t
+free_run_length (size_t block, size_t max)
+{
+  size_t block_cnt = bitmap_size (free_map);
+  size_t n = 0;
+  while (n < max && block + n < block_cnt
+         && !bitmap_test (free_map, block + n))
+    n++;
+  return n;
+}
+
+/* Finds the longest run of free blocks, up to MAX long, that starts
+   within [START, END), stores its first block into *RUNP and returns
+   its length (0 if there is none). */
+static size_t
+free_map_best_run (size_t start, size_t end, size_t max, size_t *runp)
+{
+  size_t best = 0;
+  size_t pos = start;
+  while (pos < end)
+    {
+      if (bitmap_test (free_map, pos))
+        {
+          pos++;
+          continue;
+        }
+      size_t len = free_run_length (pos, max);
+      if (len > best)
+        {
+          best = len;
+          *runp = pos;
+          if (best == max)
+            break;
+        }
+      /* The block after the run is in use. */
+      pos += len + 1;
+    }
+  return best;
+}
+
+/* Does the work of free_map_allocate_extent(), with free_map_lock
+   held, but in units of blocks rather than sectors. */
+static bool
+allocate_extent (size_t min, size_t max, size_t goal,
+                 block_sector_t *blockp, size_t *cntp)
+{
+  size_t block_cnt = bitmap_size (free_map);
+  size_t start = goal;
+  size_t cnt, i;
+
+  ASSERT (0 < min && min <= max);
+  if (goal >= block_cnt)
+    start = goal = 0;
+
+  cnt = free_run_length (goal, max);
+  if (cnt < min)
+    {
+      /* Search the groups from the goal on, wrapping around to the
+         part of the goal's group before the goal last. */
+      size_t first = goal / GROUP_BLOCKS;
+      cnt = 0;
+      for (i = 0; i <= group_cnt && cnt < min; i++)
+        {
+          size_t g = (first + i) % group_cnt;
+          size_t from = g * GROUP_BLOCKS;
+          size_t to = from + GROUP_BLOCKS < block_cnt
+                      ? from + GROUP_BLOCKS : block_cnt;
+          if (i == 0)
+            from = goal;
+          else if (i == group_cnt)
+            to = goal;
+          if (group_free[g] == 0
+              || (min <= GROUP_BLOCKS && group_free[g] < min))
+            continue;
+          cnt = free_map_best_run (from, to, max, &start);
+        }
+
+      if (cnt < min)
+        {
+          /* Only a run across several groups is long enough, if any:
+             fall back to a first-fit scan. */
+          start = bitmap_scan (free_map, 0, min, false);
+          if (start == BITMAP_ERROR)
+            return false;
+          cnt = free_run_length (start, max);
+        }
+    }
+
+  bitmap_set_multiple (free_map, start, cnt, true);
+  free_map_account (start, cnt, true);
+  free_map_mark_dirty (start, cnt);
+  *blockp = start;
+  *cntp = cnt;
+  return true;
+}
+
+/* Allocates a run of at least MIN and at most MAX consecutive
+   sectors, as close after GOAL as possible, and stores its first
+   sector into *SECTORP and its length into *CNTP.  The run starts
+   right at GOAL if that sector is free, so that a file extended with
+   GOAL just past its last sector stays contiguous.  Otherwise the
+   block groups are searched from GOAL's on, skipping those without
+   enough free sectors, and the longest run in the first group that
+   has one of MIN sectors is taken.  Sectors reserved by
+   free_map_reserve() are left alone.  The change reaches the free
+   map file with the next free_map_flush().
+   Returns false if there is no free run of MIN sectors at all. */
+bool
+free_map_allocate_extent (size_t min, size_t max, block_sector_t goal,
+                          block_sector_t *sectorp, size_t *cntp)
+{
+  bool success;
+
+  min = SECTORS_TO_BLOCKS (min);
+  max = SECTORS_TO_BLOCKS (max);
+  goal /= fs_block_sectors;
+
+  /* Blocks of removed files may still be on their way back. */
+  do
+    {
+      success = false;
+      lock_acquire (&free_map_lock);
+      if (free_cnt - reserved_cnt >= min)
+        {
+          size_t avail = free_cnt - reserved_cnt;
+          success = allocate_extent (min, max < avail ? max : avail,
+                                     goal, sectorp, cntp);
+        }
+      lock_release (&free_map_lock);
+    }
+  while (!success && inode_reclaim_wait ());
+  if (success)
+    {
+      *sectorp *= fs_block_sectors;
+      *cntp *= fs_block_sectors;
+    }
+  return success;
+}
+
+/* Reserves CNT sectors, to be allocated later with
+   free_map_allocate_reserved(), so that delayed allocation cannot
+   run out of space.  Returns false if not enough sectors are free. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  cnt = SECTORS_TO_BLOCKS (cnt);
+  do
+    {
+      lock_acquire (&free_map_lock);
+      success = free_cnt - reserved_cnt >= cnt;
+      if (success)
+        reserved_cnt += cnt;
+      lock_release (&free_map_lock);
+    }
+  while (!success && inode_reclaim_wait ());
+  return success;
+}
+
+/* Gives back CNT sectors reserved with free_map_reserve(). */
+void
+free_map_unreserve (size_t cnt)
+{
+  cnt = SECTORS_TO_BLOCKS (cnt);
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Like free_map_allocate_extent() with a MIN of 1, but takes the
+   sectors out of the caller's reservation of at least MAX sectors,
+   and so never fails. */
+void
+free_map_allocate_reserved (size_t max, block_sector_t goal,
+                            block_sector_t *sectorp, size_t *cntp)
+{
+  bool success;
+
+  max = SECTORS_TO_BLOCKS (max);
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= max);
+  success = allocate_extent (1, max, goal / fs_block_sectors, sectorp, cntp);
+  ASSERT (success);
+  reserved_cnt -= *cntp;
+  lock_release (&free_map_lock);
+  *sectorp *= fs_block_sectors;
+  *cntp *= fs_block_sectors;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  The rest of the last block is allocated
+   too (see SECTORS_TO_BLOCKS), even if CNT is 1.  The change reaches
+   the free map file with the next free_map_flush().
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
-    }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  #ifdef DEBUG
-    printf("end free_map\n");
-  #endif
-  return sector != BITMAP_ERROR;
+  size_t allocated;
+  return free_map_allocate_extent (cnt, cnt, 0, sectorp, &allocated);
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Marks the blocks of CNT sectors starting at SECTOR, which must
+   start a block, free, and adds them to the reservations if
+   RESERVED. */
+static void
+release_blocks (block_sector_t sector, size_t cnt, bool reserved)
+{
+  size_t block = sector / fs_block_sectors;
+
+  ASSERT (sector % fs_block_sectors == 0);
+  cnt = SECTORS_TO_BLOCKS (cnt);
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, block, cnt));
+  bitmap_set_multiple (free_map, block, cnt, false);
+  free_map_account (block, cnt, false);
+  free_map_mark_dirty (block, cnt);
+  if (reserved)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Makes CNT sectors starting at SECTOR, which must start a block,
+   available for use, along with the rest of their last block.  The
+   change reaches the free map file with the next free_map_flush(). */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  release_blocks (sector, cnt, false);
+}
+
+/* Gives CNT sectors starting at SECTOR, which came from
+   free_map_allocate_reserved(), back to the caller's reservation:
+   they are free again, but only for the caller.  Unlike
+   free_map_release() followed by free_map_reserve(), this cannot
+   lose the reservation to another thread in between. */
+void
+free_map_release_reserved (block_sector_t sector, size_t cnt)
+{
+  release_blocks (sector, cnt, true);
 }
 
-/* Opens the free map file and reads it from disk. */
+/* Opens the free map file and reads it from disk.  Its inode tells
+   the block size the file system was formatted with. */
 void
 free_map_open (void) 
 {
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
+  struct inode *inode = inode_open (FREE_MAP_SECTOR);
+  fs_block_sectors = inode_block_sectors (inode);
+  free_map_setup ();
+
+  free_map_file = file_open (inode);
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  free_map_count_groups ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
   file_close (free_map_file);
 }
 
@@ -75,14 +441,22 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  free_map_setup ();
+
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map),false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The first write allocates the sectors of
+     the (sparse) file, so it must not write the bitmap itself again:
+     only then is free_map_file set, and the final bitmap written. */
+  struct file *file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
+  if (!bitmap_write (free_map, file))
+    PANIC ("can't write free map");
+  free_map_file = file;
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (free_map_dirty, false);
 }
@@ -1,4 +1,5 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
@@ -6,33 +7,124 @@
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "filesys/cache.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Identifies an inode.  The low byte holds the version of the
+   on-disk format, so that an incompatible disk is told apart from a
+   corrupted one. */
+#define INODE_MAGIC_PREFIX 0x494e4f00
+#define INODE_VERSION 5   /* 2: extents, 3: inline data, 4: block size,
+                             5: entry types in directories. */
+#define INODE_MAGIC (INODE_MAGIC_PREFIX | INODE_VERSION)
+
+/* Identifies a node of an extent tree. */
+#define EXTENT_MAGIC 0x4558
+
+/* Extents held by the inode itself and by each overflow tree node. */
+#define ROOT_EXTENTS 40
+#define NODE_EXTENTS 41
+
+/* Files up to this many bytes long keep their data inside the inode,
+   in place of the extent tree root. */
+#define INLINE_MAX (sizeof (struct extent_header) \
+                    + ROOT_EXTENTS * sizeof (struct extent))
+
+/* Maximum depth of an extent tree.  Even with single-sector extents,
+   four levels map far more sectors than a block device can hold. */
+#define EXTENT_MAX_DEPTH 4
+
+/* Number of sectors queued for read-ahead beyond a sequential read. */
+#define READ_AHEAD_SECTORS 8
+
+/* Maximum number of closed inodes kept in memory for a reopen. */
+#define CLOSED_INODES_MAX 64
+
+/* Maximum number of appended blocks an inode holds back from
+   allocation, unless a file system block is larger still. */
+#define DELALLOC_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Most tree nodes one extent_insert() takes: one per level, and one
+   more for a new root level.  Each block held back reserves this
+   many for the extent it may end up in, so that its flush cannot
+   run out of space for the tree. */
+#define DELALLOC_NODES (EXTENT_MAX_DEPTH + 1)
+
+/* How often, in timer ticks, the blocks held back for delayed
+   allocation are given sectors and handed to the buffer cache, which
+   writes them back as its own write-behind settings say.  Unlike
+   the cache's -flush-interval, this cannot be turned off: it bounds
+   how long written data stays in an inode only. */
+#define DELALLOC_FLUSH_INTERVAL (5 * TIMER_FREQ)
 
-/* Identifies an inode. */
-#define INODE_MAGIC 0x494e4f44
+/**
+ * A run of blocks.  In a leaf of the extent tree, file blocks
+ * [logical, logical + length) are stored in the disk sectors from
+ * `start` on.  In an index node, `start` is the sector of a child
+ * node that maps the blocks from `logical` on, and `length` is 0.
+ */
+struct extent
+  {
+    uint32_t logical;                   /* First file block. */
+    block_sector_t start;               /* First disk sector. */
+    uint32_t length;                    /* Number of blocks. */
+  };
 
-#define DIRECT_BLOCKS_COUNT 25
-#define INDIRECT_BLOCKS_COUNT 100
-#define INDIRECT_BLOCKS_PER_SECTOR 128
+/* Header of a node of the extent tree (the root lives in the inode). */
+struct extent_header
+  {
+    uint16_t magic;                     /* EXTENT_MAGIC. */
+    uint16_t entries;                   /* Extents in use. */
+    uint16_t max;                       /* Extents that fit. */
+    uint16_t depth;                     /* 0 for a leaf. */
+    uint32_t unused;
+  };
 
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    /** Data sectors */
-    block_sector_t direct_blocks[DIRECT_BLOCKS_COUNT];
-    block_sector_t indirect_blocks[INDIRECT_BLOCKS_COUNT];
-
-    bool is_dir;
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
+    bool is_dir;
+    bool is_inline;                     /* Data in inline_data? */
+    uint8_t block_sectors;              /* fs_block_sectors, when created. */
+    uint8_t unused;
+
+    union
+      {
+        /** Root of the extent tree, sorted by logical block */
+        struct
+          {
+            struct extent_header header;
+            struct extent extents[ROOT_EXTENTS];
+          };
+        /** Or the data itself (zeros past the length) */
+        uint8_t inline_data[INLINE_MAX];
+      };
+    block_sector_t dir_index;           /* Directory's hash index, or 0. */
+    uint32_t unused2;
+  };
+
+/* Overflow node of the extent tree, one sector long. */
+struct extent_node
+  {
+    struct extent_header header;
+    struct extent extents[NODE_EXTENTS];
+    uint32_t unused[2];
   };
 
-struct inode_indirect_block_sector {
-  block_sector_t blocks[INDIRECT_BLOCKS_PER_SECTOR];
-};
+/* Sectors for new extent tree nodes, reserved before an insertion
+   so that it cannot run out of disk space halfway through. */
+struct extent_spare
+  {
+    block_sector_t sectors[EXTENT_MAX_DEPTH + 2];
+    size_t cnt;
+  };
 
-static bool inode_extend (struct inode_disk *disk_inode, off_t length);
 static bool inode_deallocate (struct inode_disk *disk_inode);
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -43,6 +135,15 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* Returns how many blocks an inode may hold back from allocation:
+   a whole number of file system blocks. */
+static inline size_t
+delalloc_max (void)
+{
+  return DELALLOC_SECTORS > fs_block_sectors
+         ? DELALLOC_SECTORS : fs_block_sectors;
+}
+
 /* get min of a and b */
 static inline size_t
 min (size_t a, size_t b)
@@ -53,15 +154,52 @@ min (size_t a, size_t b)
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem helem;             /* Element in open_inodes. */
+    struct list_elem elem;              /* Element in closed_inodes,
+                                           in reclaim_list, or in
+                                           inode_flush_all()'s list. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool loading;                       /* Still being read from disk. */
+    struct condition loaded;            /* Signaled when loading ends. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
+
+    /* Readers hold it shared, writers exclusively: it protects the
+       extent tree, the length and deny_write_cnt. */
+    struct rw_lock rwlock;
+    struct lock dir_lock;               /* Serializes a directory's entries. */
+
+    /* Updated by readers too, so protected by map_lock. */
+    struct lock map_lock;
+    off_t ra_next_ofs;                  /* Where a sequential read goes on. */
+    size_t ra_index;                    /* Read-ahead queued below this sector index. */
+
+    /* The extent found by the last lookup (length 0 if none).
+       Allocated blocks never move, so it stays valid. */
+    struct extent hint;
+
+    /* Delayed allocation: blocks appended to the file are kept in
+       da_buffer, with space reserved in the free map, until
+       inode_flush() gives them sectors, in as few runs as it can.
+       Protected by rwlock, like the extent tree. */
+    uint8_t *da_buffer;                 /* delalloc_max() blocks, or NULL. */
+    size_t da_first;                    /* File block of its first block. */
+    size_t da_cnt;                      /* Number of blocks held in it. */
+    size_t da_nodes;                    /* Sectors reserved for tree nodes. */
+    bool data_dirty;                    /* Length not written back yet. */
   };
 
 
+/* Returns the file system block size, in sectors, that INODE was
+   created with. */
+size_t
+inode_block_sectors (const struct inode *inode)
+{
+  return inode->data.block_sectors;
+}
+
 /* Returns whether the file is directory or not. */
 bool
 inode_is_directory (const struct inode *inode)
@@ -70,97 +208,711 @@ inode_is_directory (const struct inode *inode)
 }
 
 
-/* get block sector number from inode_disk and index */
+/* Returns the position of the last of the CNT extents in E, sorted
+   by logical block, that starts at or before BLOCK, or -1 if there
+   is none. */
+static int
+extent_search (const struct extent *e, size_t cnt, size_t block)
+{
+  int lo = 0, hi = (int) cnt - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (e[mid].logical <= block)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return hi;
+}
+
+/* Returns whether extent B continues extent A, both on the file
+   and on the disk, so that the two can be merged. */
+static inline bool
+extent_adjoins (const struct extent *a, const struct extent *b)
+{
+  return a->logical + a->length == b->logical
+    && a->start + a->length == b->start;
+}
+
+/* Looks up the extent of DISK_INODE that maps file block BLOCK and
+   stores it into *RESULT.  Returns false if BLOCK is not mapped. */
+static bool
+extent_lookup (const struct inode_disk *disk_inode, size_t block,
+               struct extent *result)
+{
+  const struct extent_header *h = &disk_inode->header;
+  const struct extent *e = disk_inode->extents;
+  struct extent_node *node = NULL;
+  bool found = false;
+
+  while (true) {
+    int i = extent_search (e, h->entries, block);
+    if (i < 0)
+      break;
+    if (h->depth == 0) {
+      if (block < e[i].logical + e[i].length) {
+        *result = e[i];
+        found = true;
+      }
+      break;
+    }
+
+    // descend, keeping only one node in use at a time
+    struct extent_node *child = buffer_cache_get (e[i].start,
+                                                  BUFFER_CACHE_READ);
+    if (node != NULL)
+      buffer_cache_put (node);
+    node = child;
+    ASSERT (node->header.magic == EXTENT_MAGIC);
+    h = &node->header;
+    e = node->extents;
+  }
+
+  if (node != NULL)
+    buffer_cache_put (node);
+  return found;
+}
+
+/* Returns the first file block after BLOCK that DISK_INODE maps,
+   or SIZE_MAX if there is none. */
+static size_t
+extent_next (const struct inode_disk *disk_inode, size_t block)
+{
+  const struct extent_header *h = &disk_inode->header;
+  const struct extent *e = disk_inode->extents;
+  struct extent_node *node = NULL;
+  size_t next = SIZE_MAX;
+
+  while (true) {
+    int i = extent_search (e, h->entries, block);
+    if (i + 1 < h->entries)
+      next = e[i + 1].logical;
+    if (h->depth == 0 || i < 0)
+      break;
+
+    struct extent_node *child = buffer_cache_get (e[i].start,
+                                                  BUFFER_CACHE_READ);
+    if (node != NULL)
+      buffer_cache_put (node);
+    node = child;
+    h = &node->header;
+    e = node->extents;
+  }
+
+  if (node != NULL)
+    buffer_cache_put (node);
+  return next;
+}
+
+/* Returns how many new tree nodes inserting EXT into DISK_INODE
+   takes: none if EXT extends a neighbouring extent, otherwise one
+   for each full node on the way up from the leaf, and one more if
+   the root is full too and the tree has to grow a level. */
+static size_t
+extent_nodes_needed (const struct inode_disk *disk_inode,
+                     const struct extent *ext)
+{
+  const struct extent_header *h = &disk_inode->header;
+  const struct extent *e = disk_inode->extents;
+  struct extent_node *node = NULL;
+  bool full[EXTENT_MAX_DEPTH + 1];
+  size_t level = 0, cnt = 0;
+  bool merges = false;
+
+  while (true) {
+    int i = extent_search (e, h->entries, ext->logical);
+    full[level++] = (h->entries == h->max);
+    if (h->depth == 0) {
+      merges = (i >= 0 && extent_adjoins (&e[i], ext))
+        || (i + 1 < h->entries && extent_adjoins (ext, &e[i + 1]));
+      break;
+    }
+
+    struct extent_node *child = buffer_cache_get (e[i < 0 ? 0 : i].start,
+                                                  BUFFER_CACHE_READ);
+    if (node != NULL)
+      buffer_cache_put (node);
+    node = child;
+    h = &node->header;
+    e = node->extents;
+  }
+  if (node != NULL)
+    buffer_cache_put (node);
+
+  if (merges)
+    return 0;
+  while (level > 0 && full[level - 1]) {
+    cnt ++;
+    level --;
+  }
+  if (level == 0)
+    cnt ++;   // the root splits, and grows a level
+  return cnt;
+}
+
+/* Inserts EXT at position POS of the node with header H and
+   extents E.  If the node is full, it is split: its upper half is
+   moved into a new node, taken from SPARE, and *SPLIT is set to the
+   index entry for that node. */
+static void
+extent_node_add (struct extent_header *h, struct extent *e, int pos,
+                 const struct extent *ext, struct extent_spare *spare,
+                 struct extent *split, bool *did_split)
+{
+  size_t n = h->entries;
+
+  if (n < h->max) {
+    memmove (e + pos + 1, e + pos, (n - pos) * sizeof *e);
+    e[pos] = *ext;
+    h->entries ++;
+    *did_split = false;
+    return;
+  }
+
+  struct extent all[NODE_EXTENTS + 1];
+  memcpy (all, e, pos * sizeof *e);
+  all[pos] = *ext;
+  memcpy (all + pos + 1, e + pos, (n - pos) * sizeof *e);
+
+  // appending (the usual case, as files grow): leave this node full.
+  size_t keep = (pos == (int) n) ? n : (n + 1) / 2;
+
+  ASSERT (spare->cnt > 0);
+  block_sector_t sector = spare->sectors[-- spare->cnt];
+  struct extent_node *node = buffer_cache_get (sector, BUFFER_CACHE_OVERWRITE);
+  memset (node, 0, sizeof *node);
+  node->header.magic = EXTENT_MAGIC;
+  node->header.max = NODE_EXTENTS;
+  node->header.depth = h->depth;
+  node->header.entries = n + 1 - keep;
+  memcpy (node->extents, all + keep, (n + 1 - keep) * sizeof *e);
+  buffer_cache_put (node);
+
+  memcpy (e, all, keep * sizeof *e);
+  h->entries = keep;
+
+  split->logical = all[keep].logical;
+  split->start = sector;
+  split->length = 0;
+  *did_split = true;
+}
+
+/* Inserts EXT into the subtree whose root node has header H and
+   extents E, merging it with a neighbouring extent if possible.
+   See extent_node_add() for SPARE, SPLIT and DID_SPLIT. */
+static void
+extent_insert_at (struct extent_header *h, struct extent *e,
+                  const struct extent *ext, struct extent_spare *spare,
+                  struct extent *split, bool *did_split)
+{
+  int i = extent_search (e, h->entries, ext->logical);
+
+  *did_split = false;
+  if (h->depth == 0) {
+    if (i >= 0 && extent_adjoins (&e[i], ext)) {
+      e[i].length += ext->length;
+      if (i + 1 < h->entries && extent_adjoins (&e[i], &e[i + 1])) {
+        // EXT filled the gap between two extents
+        e[i].length += e[i + 1].length;
+        memmove (e + i + 1, e + i + 2, (h->entries - i - 2) * sizeof *e);
+        h->entries --;
+      }
+    }
+    else if (i + 1 < h->entries && extent_adjoins (ext, &e[i + 1])) {
+      e[i + 1].logical = ext->logical;
+      e[i + 1].start = ext->start;
+      e[i + 1].length += ext->length;
+    }
+    else
+      extent_node_add (h, e, i + 1, ext, spare, split, did_split);
+    return;
+  }
+
+  if (i < 0) {
+    // EXT goes before everything in the subtree
+    i = 0;
+    e[0].logical = ext->logical;
+  }
+
+  struct extent_node *child = buffer_cache_get (e[i].start,
+                                                BUFFER_CACHE_WRITE);
+  struct extent child_split;
+  bool child_did_split;
+  ASSERT (child->header.magic == EXTENT_MAGIC);
+  extent_insert_at (&child->header, child->extents, ext, spare,
+                    &child_split, &child_did_split);
+  buffer_cache_put (child);
+
+  if (child_did_split)
+    extent_node_add (h, e, i + 1, &child_split, spare, split, did_split);
+}
+
+/* Maps the blocks of EXT in DISK_INODE.  The tree nodes it takes
+   come out of the *RESERVED sectors reserved by the caller, if
+   RESERVED is not null; that is always enough.  Returns false if the
+   tree nodes cannot be allocated. */
+static bool
+extent_insert (struct inode_disk *disk_inode, const struct extent *ext,
+               size_t *reserved)
+{
+  struct extent_header *root = &disk_inode->header;
+  struct extent_spare spare;
+  struct extent split;
+  bool did_split;
+
+  spare.cnt = extent_nodes_needed (disk_inode, ext);
+  if (spare.cnt > root->depth + 1u && root->depth == EXTENT_MAX_DEPTH)
+    return false;
+  size_t i;
+  for (i = 0; i < spare.cnt; ++ i)
+    if (reserved != NULL) {
+      size_t cnt;
+      ASSERT (*reserved >= fs_block_sectors);
+      free_map_allocate_reserved (1, 0, &spare.sectors[i], &cnt);
+      *reserved -= cnt;
+    }
+    else if (!free_map_allocate (1, &spare.sectors[i])) {
+      while (i-- > 0)
+        free_map_release (spare.sectors[i], 1);
+      return false;
+    }
+
+  extent_insert_at (root, disk_inode->extents, ext, &spare,
+                    &split, &did_split);
+  if (did_split) {
+    // the root overflowed: move what is left of it down into a new
+    // node, and make the root point to that one and the split-off one.
+    ASSERT (spare.cnt > 0);
+    block_sector_t sector = spare.sectors[-- spare.cnt];
+    struct extent_node *node = buffer_cache_get (sector,
+                                                 BUFFER_CACHE_OVERWRITE);
+    memset (node, 0, sizeof *node);
+    node->header = *root;
+    node->header.max = NODE_EXTENTS;
+    memcpy (node->extents, disk_inode->extents,
+            root->entries * sizeof *disk_inode->extents);
+    buffer_cache_put (node);
+
+    disk_inode->extents[0].start = sector;
+    disk_inode->extents[0].length = 0;
+    disk_inode->extents[1] = split;
+    root->entries = 2;
+    root->depth ++;
+  }
+  ASSERT (spare.cnt == 0);
+  return true;
+}
+
+/* Frees the disk sectors mapped by the extents E, described by
+   header H, and the tree nodes below them. */
+static void
+extent_free (const struct extent_header *h, const struct extent *e)
+{
+  size_t i;
+  for (i = 0; i < h->entries; ++ i) {
+    if (h->depth == 0) {
+      free_map_release (e[i].start, e[i].length);
+      continue;
+    }
+    struct extent_node *node = buffer_cache_get (e[i].start,
+                                                 BUFFER_CACHE_READ);
+    extent_free (&node->header, node->extents);
+    buffer_cache_put (node);
+    free_map_release (e[i].start, 1);
+  }
+}
+
+/* get block sector number from inode and index.
+   The caller must hold INODE's rwlock, in either mode. */
 static block_sector_t
-index_to_sector (const struct inode_disk *idisk, off_t index)
+index_to_sector (struct inode *inode, off_t index)
 {
-  off_t index_base = 0, index_limit = 0;   // base, limit for sector index
-  block_sector_t ret;
+  struct extent ext;
+
+  lock_acquire (&inode->map_lock);
+  ext = inode->hint;
+  lock_release (&inode->map_lock);
+
+  if (!(ext.logical <= (size_t) index
+        && (size_t) index < ext.logical + ext.length)) {
+    if (!extent_lookup (&inode->data, index, &ext))
+      return -1;
+    lock_acquire (&inode->map_lock);
+    inode->hint = ext;
+    lock_release (&inode->map_lock);
+  }
+  return ext.start + (index - ext.logical);
+}
 
-  // direct 
-  index_limit += DIRECT_BLOCKS_COUNT * 1;
-  if (index < index_limit) {
-    return idisk->direct_blocks[index];
+/* Maps the unmapped file blocks of INODE from BLOCK on, up to block
+   END or the next mapped one, to newly allocated sectors, as one run
+   if the free map has it.  The run is sought right after the sector
+   of the previous block, or else after the inode itself.  Sectors
+   are allocated in whole file system blocks, so the ones mapped
+   before BLOCK and from END on are zeroed, but the others are not
+   initialized: the caller has to write all of them.  Returns how
+   many blocks were mapped from BLOCK on, or 0 if the disk is full. */
+static size_t
+inode_fill_hole (struct inode *inode, size_t block, size_t end)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+  size_t first = ROUND_DOWN (block, fs_block_sectors);
+  size_t cnt = min (ROUND_UP (end, fs_block_sectors),
+                    extent_next (&inode->data, block)) - first;
+  block_sector_t goal = inode->sector + 1;
+  block_sector_t start;
+  size_t i;
+
+  ASSERT (cnt > 0);
+  if (first > 0) {
+    block_sector_t prev = index_to_sector (inode, first - 1);
+    if (prev != -1u)
+      goal = prev + 1;
   }
-  index_base = index_limit;
+  if (! free_map_allocate_extent (1, cnt, goal, &start, &cnt))
+    return 0;
 
-  // indirect 
-  // iterate all indirct blocks
-  for (int i = 0; i < INDIRECT_BLOCKS_COUNT; i++) {
-    index_limit += 1 * INDIRECT_BLOCKS_PER_SECTOR;
-    if (index < index_limit) {
-      struct inode_indirect_block_sector *indirect_idisk = malloc(BLOCK_SECTOR_SIZE);
-      // load to indirect_blocks
-      buffer_cache_read (idisk->indirect_blocks[i], indirect_idisk);
+  struct extent ext = { first, start, cnt };
+  if (! extent_insert (&inode->data, &ext, NULL)) {
+    free_map_release (start, cnt);
+    return 0;
+  }
+  buffer_cache_write (inode->sector, &inode->data);
+  inode->data_dirty = false;
+
+  end = min (end, first + cnt);
+  for (i = first; i < first + cnt; ++ i)
+    if (i < block || i >= end)
+      buffer_cache_write (start + (i - first), zeros);
+  return end - block;
+}
 
-      ret = indirect_idisk->blocks[ index - index_base ];
-      free(indirect_idisk);
+/* Moves the data of INODE out of the inode, into a block of its
+   own, and turns the rest of the inode into an empty extent tree, so
+   that the file can grow past INLINE_MAX bytes.  Returns false if
+   out of memory or disk space.  The caller must hold INODE's rwlock
+   exclusively. */
+static bool
+inode_uninline (struct inode *inode)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  uint8_t *copy = malloc (BLOCK_SECTOR_SIZE);
+
+  ASSERT (disk_inode->is_inline);
+  if (copy == NULL)
+    return false;
+  memset (copy, 0, BLOCK_SECTOR_SIZE);
+  memcpy (copy, disk_inode->inline_data, INLINE_MAX);
+
+  disk_inode->is_inline = false;
+  memset (disk_inode->inline_data, 0, INLINE_MAX);
+  disk_inode->header.magic = EXTENT_MAGIC;
+  disk_inode->header.max = ROOT_EXTENTS;
+
+  if (disk_inode->length > 0) {
+    // (this writes back the inode, too.)
+    if (inode_fill_hole (inode, 0, 1) == 0) {
+      disk_inode->is_inline = true;
+      memcpy (disk_inode->inline_data, copy, INLINE_MAX);
+      free (copy);
+      return false;
+    }
+    buffer_cache_write (index_to_sector (inode, 0), copy);
+    free_map_flush ();
+  }
+  else {
+    buffer_cache_write (inode->sector, disk_inode);
+    inode->data_dirty = false;
+  }
+  free (copy);
+  return true;
+}
 
-      return ret;
+/* Gives sectors to the blocks INODE holds back for delayed
+   allocation and writes them out, so that the blocks of an
+   append-only file end up in as few runs as possible.  The tree
+   nodes come out of the inode's reservation, so this only returns
+   false if the extent tree reached its maximum depth; the blocks not
+   mapped yet are kept in memory then.  The caller must hold INODE's
+   rwlock exclusively. */
+static bool
+inode_flush_delalloc (struct inode *inode)
+{
+  size_t done = 0;
+  bool success = true;
+
+  while (done < inode->da_cnt) {
+    size_t block = inode->da_first + done;
+    block_sector_t goal = inode->sector + 1;
+    block_sector_t start;
+    size_t cnt, i;
+
+    if (block > 0) {
+      block_sector_t prev = index_to_sector (inode, block - 1);
+      if (prev != -1u)
+        goal = prev + 1;
     }
-    index_base = index_limit;
+    free_map_allocate_reserved (inode->da_cnt - done, goal, &start, &cnt);
+
+    struct extent ext = { block, start, cnt };
+    if (! extent_insert (&inode->data, &ext, &inode->da_nodes)) {
+      // keep the rest (and its reservation) for a later attempt
+      free_map_release_reserved (start, cnt);
+      success = false;
+      break;
+    }
+    // the rest of the last file system block is zeroed.
+    for (i = 0; i < cnt; ++ i) {
+      void *data = buffer_cache_get (start + i, BUFFER_CACHE_OVERWRITE);
+      if (done + i < inode->da_cnt)
+        memcpy (data, inode->da_buffer + (done + i) * BLOCK_SECTOR_SIZE,
+                BLOCK_SECTOR_SIZE);
+      else
+        memset (data, 0, BLOCK_SECTOR_SIZE);
+      buffer_cache_put (data);
+    }
+    done = min (done + cnt, inode->da_cnt);
+  }
+
+  if (done > 0) {
+    memmove (inode->da_buffer, inode->da_buffer + done * BLOCK_SECTOR_SIZE,
+             (inode->da_cnt - done) * BLOCK_SECTOR_SIZE);
+    inode->da_first += done;
+    inode->da_cnt -= done;
+    inode->data_dirty = true;
+  }
+  if (inode->da_cnt == 0 && inode->da_nodes > 0) {
+    free_map_unreserve (inode->da_nodes);
+    inode->da_nodes = 0;
+  }
+  return success;
+}
+
+/* Writes back what INODE keeps in memory only: the blocks held back
+   for delayed allocation and the length.  The caller must hold
+   INODE's rwlock exclusively. */
+static void
+inode_flush (struct inode *inode)
+{
+  bool allocated = inode->da_cnt > 0;
+
+  if (allocated)
+    inode_flush_delalloc (inode);
+  if (inode->data_dirty) {
+    buffer_cache_write (inode->sector, &inode->data);
+    inode->data_dirty = false;
   }
-  return -1;
+  if (allocated)
+    free_map_flush ();
+}
+
+/* Returns whether file block BLOCK of INODE, which is not mapped, is
+   (now) held back for delayed allocation.  Only appends are: blocks
+   past which nothing is mapped, and which continue the blocks held
+   already, if any.  The free map file is never delayed, since it has
+   to be mapped before it can record allocations.  The blocks held
+   start at a file system block boundary, and space is reserved for
+   whole file system blocks, along with the tree nodes that mapping
+   them may take: a write that cannot have its space fails here
+   rather than losing its data when it is flushed.  The caller must
+   hold INODE's rwlock exclusively. */
+static bool
+inode_delay (struct inode *inode, size_t block)
+{
+  if (inode->da_cnt > 0 && inode->da_first <= block
+      && block < inode->da_first + inode->da_cnt)
+    return true;
+  if (inode->sector == FREE_MAP_SECTOR)
+    return false;
+
+  if (inode->da_cnt > 0) {
+    if (block == inode->da_first + inode->da_cnt
+        && inode->da_cnt < delalloc_max ())
+      goto add;
+    // full, or not an append to what is held: make room first
+    if (! inode_flush_delalloc (inode))
+      return false;
+  }
+  if (extent_next (&inode->data, block) != SIZE_MAX)
+    return false;
+
+ add:
+  if (inode->da_buffer == NULL) {
+    inode->da_buffer = malloc (delalloc_max () * BLOCK_SECTOR_SIZE);
+    if (inode->da_buffer == NULL)
+      return false;
+  }
+  if (inode->da_cnt % fs_block_sectors == 0) {
+    if (! free_map_reserve ((1 + DELALLOC_NODES) * fs_block_sectors))
+      return false;
+    inode->da_nodes += DELALLOC_NODES * fs_block_sectors;
+  }
+  if (inode->da_cnt == 0) {
+    // the blocks before BLOCK in its file system block are holes.
+    inode->da_first = ROUND_DOWN (block, fs_block_sectors);
+    inode->da_cnt = block - inode->da_first;
+    memset (inode->da_buffer, 0, inode->da_cnt * BLOCK_SECTOR_SIZE);
+  }
+  memset (inode->da_buffer + inode->da_cnt * BLOCK_SECTOR_SIZE, 0,
+          BLOCK_SECTOR_SIZE);
+  inode->da_cnt ++;
+  return true;
 }
 
 /* Returns the block device sector that contains byte offset POS within INODE. 
-   Returns -1 if INODE does not contain data for a byte at offset POS. refer to pintos */
+   Returns -1 if INODE does not contain data for a byte at offset POS,
+   either because POS is past the end or because it falls in a hole. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+byte_to_sector (struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
   if (0 <= pos && pos < inode->data.length) {
     // sector index
     off_t index = pos / BLOCK_SECTOR_SIZE;
-    return index_to_sector (&inode->data, index);
+    return index_to_sector (inode, index);
   }
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Inodes in memory, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  Besides the open inodes, it
+   holds the ones in closed_inodes. */
+static struct hash open_inodes;
+
+/* Recently closed inodes, most recently closed first, which keep
+   their `struct inode_disk' so that a reopen needs no disk access.
+   At most CLOSED_INODES_MAX of them are kept. */
+static struct list closed_inodes;
+static size_t closed_inode_cnt;
+
+/* Protects open_inodes, closed_inodes and the open_cnt, removed and
+   loading members of every inode. */
+static struct lock inode_table_lock;
+
+/* Serializes inode_flush_all(), which links the inodes it writes
+   back through their elem members. */
+static struct lock flush_all_lock;
+
+/* Removed inodes whose blocks are still to be given back to the
+   free map by the reclaimer thread, and whether it is busy with a
+   batch taken off the list.  Protected by reclaim_lock. */
+static struct list reclaim_list;
+static bool reclaim_busy;
+static struct lock reclaim_lock;
+static struct condition reclaim_nonempty;   /* Signaled when queuing. */
+static struct condition reclaim_idle;       /* Signaled after a batch. */
+
+static void reclaim_daemon (void *aux);
+static void delalloc_flush_daemon (void *aux);
+
+// Hash Functions required for [open_inodes]. Uses 'sector' as key.
+static unsigned
+inode_hash_func (const struct hash_elem *elem, void *aux UNUSED)
+{
+  struct inode *inode = hash_entry (elem, struct inode, helem);
+  return hash_int ((int) inode->sector);
+}
+
+static bool
+inode_less_func (const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  struct inode *a_inode = hash_entry (a, struct inode, helem);
+  struct inode *b_inode = hash_entry (b, struct inode, helem);
+  return a_inode->sector < b_inode->sector;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash_func, inode_less_func, NULL))
+    PANIC ("inode table creation failed");
+  list_init (&closed_inodes);
+  closed_inode_cnt = 0;
+  lock_init (&inode_table_lock);
+  lock_init (&flush_all_lock);
+
+  list_init (&reclaim_list);
+  reclaim_busy = false;
+  lock_init (&reclaim_lock);
+  cond_init (&reclaim_nonempty);
+  cond_init (&reclaim_idle);
+  if (thread_create ("reclaim", PRI_DEFAULT, reclaim_daemon, NULL)
+      == TID_ERROR)
+    PANIC ("can't create the reclaimer thread");
+  if (thread_create ("delalloc-flush", PRI_DEFAULT, delalloc_flush_daemon,
+                     NULL) == TID_ERROR)
+    PANIC ("can't create the delayed allocation flusher thread");
+}
+
+/* Returns the in-memory inode for SECTOR, open or recently closed,
+   or a null pointer if there is none. */
+static struct inode *
+inode_lookup (block_sector_t sector)
+{
+  struct inode tmp;
+  struct hash_elem *e;
+
+  tmp.sector = sector;
+  e = hash_find (&open_inodes, &tmp.helem);
+  return e != NULL ? hash_entry (e, struct inode, helem) : NULL;
+}
+
+/* Frees INODE, which must be closed, from memory. */
+static void
+inode_forget (struct inode *inode)
+{
+  ASSERT (inode->open_cnt == 0);
+  list_remove (&inode->elem);
+  closed_inode_cnt--;
+  hash_delete (&open_inodes, &inode->helem);
+  ASSERT (inode->da_cnt == 0 && inode->da_nodes == 0);
+  free (inode->da_buffer);
+  free (inode);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
-   Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   device.  Up to INLINE_MAX bytes of data live in the inode
+   itself; otherwise the data is one big hole: no sector is
+   allocated before it is written.
+   Returns true if successful. */
 bool
 inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
-  bool success = false;
 
   ASSERT (length >= 0);
 
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
-
-  disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
-    {
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      disk_inode->is_dir = is_dir;
-      if (inode_extend (disk_inode, length))
-        {
-          // write to cache
-          buffer_cache_write (sector, disk_inode);
-          success = true;
-        }
-      free (disk_inode);
-    }
-  return success;
+  ASSERT (sizeof (struct extent_node) == BLOCK_SECTOR_SIZE);
+
+  // a stale copy of whatever lived in SECTOR before must not be reopened
+  lock_acquire (&inode_table_lock);
+  struct inode *stale = inode_lookup (sector);
+  if (stale != NULL) {
+    ASSERT (stale->open_cnt == 0);
+    inode_forget (stale);
+  }
+  lock_release (&inode_table_lock);
+
+  // build the inode right in its cache entry
+  disk_inode = buffer_cache_get (sector, BUFFER_CACHE_OVERWRITE);
+  memset (disk_inode, 0, sizeof *disk_inode);
+  disk_inode->length = length;
+  disk_inode->magic = INODE_MAGIC;
+  disk_inode->is_dir = is_dir;
+  disk_inode->is_inline = (size_t) length <= INLINE_MAX;
+  disk_inode->block_sectors = fs_block_sectors;
+  if (!disk_inode->is_inline) {
+    disk_inode->header.magic = EXTENT_MAGIC;
+    disk_inode->header.max = ROOT_EXTENTS;
+  }
+  buffer_cache_put (disk_inode);
+  return true;
 }
 
 /* Reads an inode from SECTOR
@@ -169,34 +921,69 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  /* Check whether this inode is already open, or was closed recently. */
+  lock_acquire (&inode_table_lock);
+  inode = inode_lookup (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
+      if (inode->open_cnt == 0)
         {
-          inode_reopen (inode);
-          return inode;
+          list_remove (&inode->elem);
+          closed_inode_cnt--;
         }
+      inode->open_cnt++;
+      while (inode->loading)
+        cond_wait (&inode->loaded, &inode_table_lock);
+      lock_release (&inode_table_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&inode_table_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  // load to indirect_blocks
+  inode->loading = true;
+  cond_init (&inode->loaded);
+  inode->ra_next_ofs = 0;
+  inode->ra_index = 0;
+  inode->hint.length = 0;
+  inode->da_buffer = NULL;
+  inode->da_cnt = 0;
+  inode->da_nodes = 0;
+  inode->data_dirty = false;
+  rw_lock_init (&inode->rwlock);
+  lock_init (&inode->dir_lock);
+  lock_init (&inode->map_lock);
+
+  /* Only a complete inode may be found: the table hashes on sector. */
+  if (hash_insert (&open_inodes, &inode->helem) != NULL)
+    NOT_REACHED ();
+
+  /* Read it without the table lock, so that a cold open does not hold
+     up everybody else's; others opening it meanwhile wait for it. */
+  lock_release (&inode_table_lock);
   buffer_cache_read (inode->sector, &inode->data);
+  if ((inode->data.magic & ~0xffu) != INODE_MAGIC_PREFIX)
+    PANIC ("sector %"PRDSNu": not an inode", sector);
+  if (inode->data.magic != INODE_MAGIC)
+    PANIC ("sector %"PRDSNu": inode format version %u, expected %u "
+           "(reformat the file system)", sector,
+           inode->data.magic & 0xff, INODE_VERSION);
+  lock_acquire (&inode_table_lock);
+  inode->loading = false;
+  cond_broadcast (&inode->loaded, &inode_table_lock);
+  lock_release (&inode_table_lock);
   return inode;
 }
 
@@ -205,7 +992,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inode_table_lock);
+      inode->open_cnt++;
+      lock_release (&inode_table_lock);
+    }
   return inode;
 }
 
@@ -216,9 +1007,36 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Returns the sector of the inode of the hashed index of directory
+   INODE, or 0 if it has none. */
+block_sector_t
+inode_dir_index (struct inode *inode)
+{
+  block_sector_t sector;
+
+  rw_lock_acquire_shared (&inode->rwlock);
+  sector = inode->data.dir_index;
+  rw_lock_release_shared (&inode->rwlock);
+  return sector;
+}
+
+/* Records SECTOR (or 0 for none) as the inode of the hashed index of
+   directory INODE. */
+void
+inode_set_dir_index (struct inode *inode, block_sector_t sector)
+{
+  rw_lock_acquire_exclusive (&inode->rwlock);
+  inode->data.dir_index = sector;
+  buffer_cache_write (inode->sector, &inode->data);
+  inode->data_dirty = false;
+  rw_lock_release_exclusive (&inode->rwlock);
+}
+
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, it joins the closed
+   inodes kept for a later reopen, which are freed from memory in
+   LRU order.  If INODE was also a removed inode, frees it and its
+   blocks at once. */
 void
 inode_close (struct inode *inode)
 {
@@ -226,21 +1044,166 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
+  /* The last closer writes back what was delayed while it still holds
+     its reference, but not the table lock: other inodes' opens and
+     closes need not wait for this one's disk writes.  Nobody else
+     uses INODE while open_cnt is 1, so the fields tested are stable;
+     someone may reopen it and write meanwhile, hence the loop. */
+  lock_acquire (&inode_table_lock);
+  while (inode->open_cnt == 1 && !inode->removed
+         && (inode->da_cnt > 0 || inode->data_dirty))
+    {
+      lock_release (&inode_table_lock);
+      rw_lock_acquire_exclusive (&inode->rwlock);
+      inode_flush (inode);
+      /* Their tree nodes were reserved with them, so they all got
+         mapped, short of a tree deeper than any device needs. */
+      ASSERT (inode->da_cnt == 0);
+      rw_lock_release_exclusive (&inode->rwlock);
+      lock_acquire (&inode_table_lock);
+    }
+
   /* Release resources if this was the last opener. */
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
-
-      /* Deallocate blocks if removed. */
+      /* Deallocate blocks if removed.  Nobody can find the inode any
+         more, so that needs no lock.  Walking the extent tree of a
+         big file takes a while, so that is left to the reclaimer. */
       if (inode->removed)
         {
-          free_map_release (inode->sector, 1);
-          inode_deallocate (&inode->data);
+          hash_delete (&open_inodes, &inode->helem);
+          lock_release (&inode_table_lock);
+          free_map_unreserve (inode->da_cnt);
+          free_map_unreserve (inode->da_nodes);
+          free (inode->da_buffer);
+          inode->da_buffer = NULL;
+          inode->da_cnt = 0;
+          inode->da_nodes = 0;
+          if (inode->data.is_inline)
+            {
+              free_map_release (inode->sector, 1);
+              free_map_flush ();
+              free (inode);
+              return;
+            }
+
+          lock_acquire (&reclaim_lock);
+          list_push_back (&reclaim_list, &inode->elem);
+          cond_signal (&reclaim_nonempty, &reclaim_lock);
+          lock_release (&reclaim_lock);
+          return;
         }
 
+      /* Keep it around for a while, dropping the least recently
+         closed inode if there are too many. */
+      list_push_front (&closed_inodes, &inode->elem);
+      closed_inode_cnt++;
+      if (closed_inode_cnt > CLOSED_INODES_MAX)
+        inode_forget (list_entry (list_back (&closed_inodes),
+                                  struct inode, elem));
+    }
+  lock_release (&inode_table_lock);
+}
+
+/* Reclaimer thread: gives the blocks of removed inodes back to the
+   free map, a batch of inodes at a time, and writes the free map back
+   once per batch.  The inode's own sector goes last, so that it is
+   not reused while its extent tree is still being read. */
+static void
+reclaim_daemon (void *aux UNUSED)
+{
+  struct list batch;
+
+  list_init (&batch);
+  while (true) {
+    lock_acquire (&reclaim_lock);
+    while (list_empty (&reclaim_list))
+      cond_wait (&reclaim_nonempty, &reclaim_lock);
+    // take the whole list, so that closers need not wait meanwhile.
+    while (!list_empty (&reclaim_list))
+      list_push_back (&batch, list_pop_front (&reclaim_list));
+    reclaim_busy = true;
+    lock_release (&reclaim_lock);
+
+    while (!list_empty (&batch)) {
+      struct inode *inode = list_entry (list_pop_front (&batch),
+                                        struct inode, elem);
+      inode_deallocate (&inode->data);
+      free_map_release (inode->sector, 1);
       free (inode);
     }
+    free_map_flush ();
+
+    lock_acquire (&reclaim_lock);
+    reclaim_busy = false;
+    cond_broadcast (&reclaim_idle, &reclaim_lock);
+    lock_release (&reclaim_lock);
+  }
+}
+
+/* Waits until the reclaimer has given back the blocks of every
+   inode removed so far.  Returns true if there were any, so that an
+   allocation that failed may be worth another try. */
+bool
+inode_reclaim_wait (void)
+{
+  bool waited = false;
+
+  lock_acquire (&reclaim_lock);
+  while (reclaim_busy || !list_empty (&reclaim_list)) {
+    waited = true;
+    cond_wait (&reclaim_idle, &reclaim_lock);
+  }
+  lock_release (&reclaim_lock);
+  return waited;
+}
+
+/* Delayed allocation flusher thread: writes back the delayed blocks
+   and lengths of all inodes every DELALLOC_FLUSH_INTERVAL ticks. */
+static void
+delalloc_flush_daemon (void *aux UNUSED)
+{
+  while (true) {
+    timer_sleep (DELALLOC_FLUSH_INTERVAL);
+    inode_flush_all ();
+  }
+}
+
+/* Writes back the delayed blocks and lengths of all inodes in
+   memory, for sync(), periodically and at shutdown.  The open inodes are taken
+   hold of under the table lock, but written back without it.  The
+   closed ones were written back by their last close. */
+void
+inode_flush_all (void)
+{
+  struct hash_iterator i;
+  struct list open;
+
+  list_init (&open);
+  lock_acquire (&flush_all_lock);
+  lock_acquire (&inode_table_lock);
+  hash_first (&i, &open_inodes);
+  while (hash_next (&i))
+    {
+      struct inode *inode = hash_entry (hash_cur (&i), struct inode, helem);
+      if (inode->open_cnt > 0 && !inode->removed && !inode->loading)
+        {
+          inode->open_cnt++;
+          list_push_back (&open, &inode->elem);
+        }
+    }
+  lock_release (&inode_table_lock);
+
+  while (!list_empty (&open))
+    {
+      struct inode *inode = list_entry (list_pop_front (&open),
+                                        struct inode, elem);
+      rw_lock_acquire_exclusive (&inode->rwlock);
+      inode_flush (inode);
+      rw_lock_release_exclusive (&inode->rwlock);
+      inode_close (inode);
+    }
+  lock_release (&flush_all_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -249,7 +1212,75 @@ void
 inode_remove (struct inode *inode)
 {
   ASSERT (inode != NULL);
+  lock_acquire (&inode_table_lock);
   inode->removed = true;
+  lock_release (&inode_table_lock);
+}
+
+/* Acquires the lock that serializes the lookups and changes of the
+   entries of INODE, a directory. */
+void
+inode_dir_lock (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases the lock acquired by inode_dir_lock(). */
+void
+inode_dir_unlock (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
+
+/* Records a read of INODE covering bytes [START, END).  If it continues
+   the previous read, the following READ_AHEAD_SECTORS sectors are queued
+   for the read-ahead thread, so that they are (being) fetched by the time
+   the reader gets there. */
+static void
+inode_read_ahead (struct inode *inode, off_t start, off_t end)
+{
+  lock_acquire (&inode->map_lock);
+  bool sequential = (start == inode->ra_next_ofs);
+  inode->ra_next_ofs = end;
+  if (!sequential) {
+    inode->ra_index = 0;
+    lock_release (&inode->map_lock);
+    return;
+  }
+
+  // sector indices: the first one not touched by this read, up to the window end.
+  size_t first = DIV_ROUND_UP (end, BLOCK_SECTOR_SIZE);
+  size_t last = min (first + READ_AHEAD_SECTORS,
+                     bytes_to_sectors (inode_length (inode)));
+  size_t from = (first > inode->ra_index ? first : inode->ra_index);
+  size_t index;
+  if (last > inode->ra_index)
+    inode->ra_index = last;
+  lock_release (&inode->map_lock);
+
+  // queue runs of consecutive sectors, to be read in one request each
+  block_sector_t run_start = 0;
+  size_t run_cnt = 0;
+  for (index = from; index < last; ++ index) {
+    block_sector_t sector = index_to_sector (inode, index);
+    if (sector == -1u) {
+      // nothing to read in a hole
+      if (run_cnt > 0)
+        buffer_cache_read_ahead (run_start, run_cnt);
+      run_cnt = 0;
+      continue;
+    }
+    if (run_cnt > 0 && sector == run_start + run_cnt) {
+      run_cnt ++;
+      continue;
+    }
+    if (run_cnt > 0)
+      buffer_cache_read_ahead (run_start, run_cnt);
+    run_start = sector;
+    run_cnt = 1;
+  }
+  if (run_cnt > 0)
+    buffer_cache_read_ahead (run_start, run_cnt);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -260,9 +1291,19 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  /* We need a bounce buffer. */
-  uint8_t *bounce = malloc (BLOCK_SECTOR_SIZE);
-
+  off_t start = offset;
+
+  rw_lock_acquire_shared (&inode->rwlock);
+  if (inode->data.is_inline) {
+    // no need to look any further than the inode
+    if (offset < inode->data.length) {
+      bytes_read = inode->data.length - offset < size
+                   ? inode->data.length - offset : size;
+      memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+    }
+    rw_lock_release_shared (&inode->rwlock);
+    return bytes_read;
+  }
   while (size > 0)
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -279,34 +1320,42 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          // load to indirect_blocks
-          buffer_cache_read (sector_idx, buffer + bytes_read);
-        }
-      else
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          // load to indirect_blocks
-          buffer_cache_read (sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      size_t block = offset / BLOCK_SECTOR_SIZE;
+      if (sector_idx == -1u && inode->da_cnt > 0
+          && inode->da_first <= block
+          && block < inode->da_first + inode->da_cnt)
+        // held back for delayed allocation
+        memcpy (buffer + bytes_read,
+                inode->da_buffer + (block - inode->da_first) * BLOCK_SECTOR_SIZE
+                + sector_ofs, chunk_size);
+      else if (sector_idx == -1u)
+        // a hole reads as zeros
+        memset (buffer + bytes_read, 0, chunk_size);
+      else {
+        // copy straight out of the cache
+        uint8_t *data = buffer_cache_get (sector_idx, BUFFER_CACHE_READ);
+        memcpy (buffer + bytes_read, data + sector_ofs, chunk_size);
+        buffer_cache_put (data);
+      }
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  if (bytes_read > 0)
+    inode_read_ahead (inode, start, start + bytes_read);
+  rw_lock_release_shared (&inode->rwlock);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode).
+   less than SIZE if the disk is full.  A write past the end of
+   file extends the inode, leaving a hole in between; sectors are
+   only allocated for the blocks actually written.
    */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
@@ -314,23 +1363,35 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  /* We need a bounce buffer. */
-  uint8_t *bounce = malloc (BLOCK_SECTOR_SIZE);
+  size_t fresh_first = 0, fresh_end = 0;  // blocks mapped by this write
+  bool allocated = false;
 
-  if (inode->deny_write_cnt)
+  rw_lock_acquire_exclusive (&inode->rwlock);
+  if (inode->deny_write_cnt) {
+    rw_lock_release_exclusive (&inode->rwlock);
     return 0;
+  }
 
-  // beyond the EOF: extend the file
-  if( byte_to_sector(inode, offset + size - 1) == -1u ) {
-    // extend and reserve up to [offset + size] bytes
-    bool success;
-    success = inode_extend (& inode->data, offset + size);
-    if (!success) return 0;  // fail?
+  if (inode->data.is_inline && (size_t) (offset + size) <= INLINE_MAX) {
+    // the inode sector is the data sector
+    memcpy (inode->data.inline_data + offset, buffer, size);
+    if (offset + size > inode->data.length)
+      inode->data.length = offset + size;
+    buffer_cache_write (inode->sector, &inode->data);
+    inode->data_dirty = false;
+    rw_lock_release_exclusive (&inode->rwlock);
+    return size;
+  }
+  if (inode->data.is_inline && !inode_uninline (inode)) {
+    rw_lock_release_exclusive (&inode->rwlock);
+    return 0;
+  }
 
-    // write back the (extended) file size
+  // beyond the EOF: extend the file.  the new size is written back
+  // along with the next change of the extents, or by inode_flush().
+  if (offset + size > inode->data.length) {
     inode->data.length = offset + size;
-    // write to cache
-    buffer_cache_write (inode->sector, & inode->data);
+    inode->data_dirty = true;
   }
 
   while (size > 0)
@@ -349,31 +1410,58 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          // write to cache
-          buffer_cache_write (sector_idx, buffer + bytes_written);
-        }
-      else
-        {
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. refer to pintos */
-          if (sector_ofs > 0 || chunk_size < sector_left)
-            buffer_cache_read (sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          // write to cache
-          buffer_cache_write (sector_idx, bounce);
-        }
+      /* If the sector contains data before or after the chunk
+         we're writing, then the cache needs to read in the sector
+         first.  Otherwise it is overwritten as a whole. */
+      enum buffer_cache_mode mode = BUFFER_CACHE_OVERWRITE;
+      if (sector_ofs > 0 || chunk_size < sector_left)
+        mode = BUFFER_CACHE_WRITE;
+
+      size_t block = offset / BLOCK_SECTOR_SIZE;
+      if (sector_idx == -1u && inode_delay (inode, block)) {
+        // an append: leave it in memory for now
+        uint8_t *data = inode->da_buffer
+          + (block - inode->da_first) * BLOCK_SECTOR_SIZE;
+        memcpy (data + sector_ofs, buffer + bytes_written, chunk_size);
+        size -= chunk_size;
+        offset += chunk_size;
+        bytes_written += chunk_size;
+        continue;
+      }
+      if (sector_idx == -1u) {
+        // a hole: map it, as far as this write goes
+        size_t cnt = inode_fill_hole (inode, block,
+                                      bytes_to_sectors (offset + size));
+        if (cnt == 0)
+          break;
+        allocated = true;
+        fresh_first = block;
+        fresh_end = block + cnt;
+        sector_idx = byte_to_sector (inode, offset);
+      }
+
+      // a new sector holds garbage: zero it rather than read it in.
+      bool fresh = (fresh_first <= block && block < fresh_end);
+      if (fresh)
+        mode = BUFFER_CACHE_OVERWRITE;
+
+      // copy straight into the cache
+      uint8_t *data = buffer_cache_get (sector_idx, mode);
+      if (fresh && (sector_ofs > 0 || chunk_size < sector_left))
+        memset (data, 0, BLOCK_SECTOR_SIZE);
+      memcpy (data + sector_ofs, buffer + bytes_written, chunk_size);
+      buffer_cache_put (data);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  // (the free map file never has holes, so this does not recurse.)
+  if (allocated)
+    free_map_flush ();
+  rw_lock_release_exclusive (&inode->rwlock);
 
   return bytes_written;
 }
@@ -383,8 +1471,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode)
 {
+  rw_lock_acquire_exclusive (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rw_lock_release_exclusive (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -393,9 +1483,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode)
 {
+  rw_lock_acquire_exclusive (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rw_lock_release_exclusive (&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -413,111 +1505,12 @@ inode_is_removed (const struct inode *inode)
   return inode->removed;
 }
 
-/**
- * Extend inode blocks, so that the file can hold at least
- * `length` bytes.
- */
-static bool
-inode_extend (struct inode_disk *disk_inode, off_t length)
-{
-  static char zeros[BLOCK_SECTOR_SIZE];
-  if (length < 0) return false;
-
-  // (remaining) number of sectors, occupied by this file.
-  size_t num_sectors = bytes_to_sectors(length);
-  size_t l;
-
-  // direct
-  l = min(num_sectors, DIRECT_BLOCKS_COUNT * 1);
-  for (int i = 0; i < l; ++ i) {
-    // if the block is not occupied, do allocate
-    if (disk_inode->direct_blocks[i] == 0) { 
-      if(! free_map_allocate (1, &disk_inode->direct_blocks[i]))
-        return false;
-      // write to cache
-      buffer_cache_write (disk_inode->direct_blocks[i], zeros);
-    }
-    num_sectors -= 1;
-  }
-  if(num_sectors == 0) return true;
-
-  // indirect
-  for (int k = 0; k < INDIRECT_BLOCKS_COUNT; k++) {
-    l = min(num_sectors, 1 * INDIRECT_BLOCKS_PER_SECTOR);
-    struct inode_indirect_block_sector *new_indirect_block = malloc(BLOCK_SECTOR_SIZE);
-    // if the block is not occupied, do allocate
-    if(disk_inode->indirect_blocks[k] == 0) {
-      // not yet allocated: allocate it, and fill with zero
-      if(! free_map_allocate (1, &disk_inode->indirect_blocks[k]))
-        return false;
-      // write to cache
-      buffer_cache_write (disk_inode->indirect_blocks[k], zeros);
-    }
-    // load to new_indirect_block
-    buffer_cache_read(disk_inode->indirect_blocks[k], new_indirect_block);
-    
-    // for one indirect block, view as many direct ones
-    for (int i = 0; i < l; ++i) {
-      // if the block is not occupied, do allocate
-      if (new_indirect_block->blocks[i] == 0) {
-        if(! free_map_allocate (1, &new_indirect_block->blocks[i]))
-          return false;
-        // write to cache
-        buffer_cache_write (new_indirect_block->blocks[i], zeros);
-      }
-      num_sectors -= 1;
-    }
-    // write to cache
-    buffer_cache_write (disk_inode->indirect_blocks[k], new_indirect_block);
-
-    free(new_indirect_block);
-    if(num_sectors == 0) return true;
-  }
-
-  return false;
-}
-
-
 /* deallocate disk_inode */
 static
 bool inode_deallocate (struct inode_disk *disk_inode)
 {
-  off_t file_length = disk_inode->length; // bytes
-  if(file_length < 0) return false;
-
-  // (remaining) number of sectors, occupied by this file.
-  size_t num_sectors = bytes_to_sectors(file_length);
-  size_t i, l;
-
-  // direct
-  l = min(num_sectors, DIRECT_BLOCKS_COUNT * 1);
-  for (i = 0; i < l; ++i) {
-    free_map_release (disk_inode->direct_blocks[i], 1);
-  }
-  num_sectors -= l;
-  if (num_sectors == 0)
+  if (disk_inode->is_inline)
     return true;
-
-  // indirect
-  for (int i = 0; i < INDIRECT_BLOCKS_COUNT; i++) {
-    l = min(num_sectors, 1 * INDIRECT_BLOCKS_PER_SECTOR);
-    if(l > 0) {
-      struct inode_indirect_block_sector *one_indirect_block = malloc(BLOCK_SECTOR_SIZE);
-      buffer_cache_read(disk_inode->indirect_blocks[i], one_indirect_block);
-      for (int i = 0; i < l; i++) {
-        free_map_release (disk_inode->indirect_blocks[i], 1);
-        num_sectors -= 1;
-      }
-
-      ASSERT (num_sectors == 0);
-      free_map_release (disk_inode->indirect_blocks[i], 1);
-      free(one_indirect_block);
-
-    }
-    if (num_sectors == 0)
-      return true;
-  }
-
+  extent_free (&disk_inode->header, disk_inode->extents);
   return true;
 }
-
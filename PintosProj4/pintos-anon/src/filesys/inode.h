@@ -20,6 +20,13 @@ void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
 bool inode_is_directory (const struct inode *);
+size_t inode_block_sectors (const struct inode *);
 bool inode_is_removed (const struct inode *);
+void inode_flush_all (void);
+bool inode_reclaim_wait (void);
+block_sector_t inode_dir_index (struct inode *);
+void inode_set_dir_index (struct inode *, block_sector_t);
+void inode_dir_lock (struct inode *);
+void inode_dir_unlock (struct inode *);
 
 #endif /* filesys/inode.h */
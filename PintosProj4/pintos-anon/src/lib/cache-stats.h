@@ -0,0 +1,22 @@
+#ifndef __LIB_CACHE_STATS_H
+#define __LIB_CACHE_STATS_H
+
+/* Buffer cache statistics, as returned by the cache_stats system
+   call.  All counts are since boot. */
+struct cache_stats
+  {
+    unsigned long long hits;            /* Accesses served from the cache. */
+    unsigned long long misses;          /* Accesses that needed a new entry. */
+    unsigned long long clean_evictions; /* Evicted entries that were clean. */
+    unsigned long long dirty_evictions; /* ...that were written back first. */
+    unsigned long long writebacks;      /* Entries written back to disk. */
+    unsigned long long lock_waits;      /* Times a cache lock was contended. */
+    unsigned long long lock_wait_ticks; /* Timer ticks spent waiting for one. */
+    unsigned long long read_ahead_issued; /* Sectors fetched by read-ahead. */
+    unsigned long long read_ahead_used;   /* ...accessed on demand later on. */
+    unsigned long long read_ahead_wasted; /* ...dropped without being used. */
+    unsigned long long disk_reads;      /* Sectors read from the fs device. */
+    unsigned long long disk_writes;     /* Sectors written to it. */
+  };
+
+#endif /* lib/cache-stats.h */
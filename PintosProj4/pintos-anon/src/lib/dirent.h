@@ -0,0 +1,17 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <stdbool.h>
+
+/* Maximum characters in a file name in a struct dirent. */
+#define DIRENT_NAME_MAX 14
+
+/* Directory entry, as returned by the getdents system call. */
+struct dirent
+  {
+    int inumber;                        /* Inode number. */
+    bool is_dir;                        /* A directory? */
+    char name[DIRENT_NAME_MAX + 1];     /* Null terminated file name. */
+  };
+
+#endif /* lib/dirent.h */
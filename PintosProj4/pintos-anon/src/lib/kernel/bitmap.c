@@ -358,6 +358,23 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes at offset OFS of B's file image (as
+   written by bitmap_write()) to the same place in FILE.  The range
+   is clipped to the end of the image.  Return true if successful,
+   false otherwise. */
+bool
+bitmap_write_partial (const struct bitmap *b, struct file *file,
+                      size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+  if (ofs >= file_size)
+    return true;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+         == (off_t) size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
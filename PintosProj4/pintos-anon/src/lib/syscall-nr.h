@@ -29,7 +29,10 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_SYNC,                   /* Writes cached file data to disk. */
+    SYS_CACHE_STATS,            /* Reads buffer cache statistics. */
+    SYS_GETDENTS                /* Reads many directory entries. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -182,3 +182,21 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+void
+sync (void)
+{
+  syscall0 (SYS_SYNC);
+}
+
+bool
+cache_stats (struct cache_stats *stats)
+{
+  return syscall1 (SYS_CACHE_STATS, stats);
+}
+
+int
+getdents (int fd, struct dirent *entries, unsigned size)
+{
+  return syscall3 (SYS_GETDENTS, fd, entries, size);
+}
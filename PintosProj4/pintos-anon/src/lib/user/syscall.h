@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <cache-stats.h>
+#include <dirent.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -44,5 +46,8 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+void sync (void);
+bool cache_stats (struct cache_stats *);
+int getdents (int fd, struct dirent *, unsigned size);
 
 #endif /* lib/user/syscall.h */
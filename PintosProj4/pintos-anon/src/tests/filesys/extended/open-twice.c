@@ -0,0 +1,34 @@
+/* Opens the same file twice, then grows it through the first file
+   descriptor.  Both must refer to the one in-memory inode, so the
+   second one sees the new length at once. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[1234];
+
+void
+test_main (void) 
+{
+  int fd1, fd2, size;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create ("foobar", 0), "create \"foobar\"");
+  CHECK ((fd1 = open ("foobar")) > 1, "open \"foobar\"");
+  CHECK ((fd2 = open ("foobar")) > 1, "open \"foobar\" again");
+  CHECK (inumber (fd1) == inumber (fd2), "compare inode numbers");
+  CHECK (write (fd1, buf, sizeof buf) == sizeof buf,
+         "write \"foobar\" through first descriptor");
+
+  msg ("size of \"foobar\" through second descriptor");
+  size = filesize (fd2);
+  if (size != sizeof buf)
+    fail ("size should be %zu, actually %d", sizeof buf, size);
+
+  msg ("close \"foobar\" twice");
+  close (fd1);
+  close (fd2);
+  check_file ("foobar", buf, sizeof buf);
+}
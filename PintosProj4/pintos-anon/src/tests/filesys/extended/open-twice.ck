@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(open-twice) begin
+(open-twice) create "foobar"
+(open-twice) open "foobar"
+(open-twice) open "foobar" again
+(open-twice) compare inode numbers
+(open-twice) write "foobar" through first descriptor
+(open-twice) size of "foobar" through second descriptor
+(open-twice) close "foobar" twice
+(open-twice) open "foobar" for verification
+(open-twice) verified contents of "foobar"
+(open-twice) close "foobar"
+(open-twice) end
+EOF
+pass;
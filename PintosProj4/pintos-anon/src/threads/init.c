@@ -38,6 +38,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -259,6 +260,23 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-block-size"))
+        {
+          if (!filesys_set_block_size (atoi (value)))
+            PANIC ("bad file system block size `%s' (use -h for help)",
+                   value);
+        }
+      else if (!strcmp (name, "-cache"))
+        buffer_cache_set_size (atoi (value));
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (!buffer_cache_set_policy (value))
+            PANIC ("unknown cache policy `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-flush-interval"))
+        buffer_cache_set_flush_interval (atoi (value));
+      else if (!strcmp (name, "-flush-threshold"))
+        buffer_cache_set_flush_threshold (atoi (value));
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -385,6 +403,15 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -block-size=BYTES  Format with blocks of BYTES: 512 (default),\n"
+          "                     1024, 2048, 4096 or 8192.\n"
+          "  -cache=COUNT       Cache up to COUNT disk sectors in memory.\n"
+          "  -cache-policy=NAME Replace cached sectors by NAME: clock (default)\n"
+          "                     or 2q (scan resistant).\n"
+          "  -flush-interval=TICKS  Write dirty cache blocks back every TICKS\n"
+          "                     timer ticks (0 disables periodic write-back).\n"
+          "  -flush-threshold=COUNT  Write dirty cache blocks back as soon as\n"
+          "                     COUNT blocks are dirty (0 disables).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -383,3 +383,125 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes readers-writer lock RW. */
+void
+rw_lock_init (struct rw_lock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->readers_ok);
+  cond_init (&rw->writer_ok);
+  rw->readers = 0;
+  rw->waiting_writers = 0;
+  rw->writer = NULL;
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   is waiting for it.  Must not be called by a thread that already
+   holds RW in either mode. */
+void
+rw_lock_acquire_shared (struct rw_lock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rw->writer != thread_current ());
+
+  lock_acquire (&rw->lock);
+  while (rw->writer != NULL || rw->waiting_writers > 0)
+    cond_wait (&rw->readers_ok, &rw->lock);
+  rw->readers++;
+  lock_release (&rw->lock);
+}
+
+/* Tries to acquire RW for reading without sleeping, and returns
+   true if successful or false on failure. */
+bool
+rw_lock_try_acquire_shared (struct rw_lock *rw)
+{
+  bool success;
+
+  ASSERT (rw != NULL);
+  ASSERT (rw->writer != thread_current ());
+
+  lock_acquire (&rw->lock);
+  success = rw->writer == NULL && rw->waiting_writers == 0;
+  if (success)
+    rw->readers++;
+  lock_release (&rw->lock);
+  return success;
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void
+rw_lock_release_shared (struct rw_lock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0)
+    cond_signal (&rw->writer_ok, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it in either mode. */
+void
+rw_lock_acquire_exclusive (struct rw_lock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rw->writer != thread_current ());
+
+  lock_acquire (&rw->lock);
+  rw->waiting_writers++;
+  while (rw->writer != NULL || rw->readers > 0)
+    cond_wait (&rw->writer_ok, &rw->lock);
+  rw->waiting_writers--;
+  rw->writer = thread_current ();
+  lock_release (&rw->lock);
+}
+
+/* Tries to acquire RW for writing without sleeping, and returns
+   true if successful or false on failure. */
+bool
+rw_lock_try_acquire_exclusive (struct rw_lock *rw)
+{
+  bool success;
+
+  ASSERT (rw != NULL);
+  ASSERT (rw->writer != thread_current ());
+
+  lock_acquire (&rw->lock);
+  success = rw->writer == NULL && rw->readers == 0;
+  if (success)
+    rw->writer = thread_current ();
+  lock_release (&rw->lock);
+  return success;
+}
+
+/* Releases RW, which the current thread holds for writing.
+   Another writer is preferred over the waiting readers. */
+void
+rw_lock_release_exclusive (struct rw_lock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rw_lock_held_exclusive (rw));
+
+  lock_acquire (&rw->lock);
+  rw->writer = NULL;
+  if (rw->waiting_writers > 0)
+    cond_signal (&rw->writer_ok, &rw->lock);
+  else
+    cond_broadcast (&rw->readers_ok, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing. */
+bool
+rw_lock_held_exclusive (const struct rw_lock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
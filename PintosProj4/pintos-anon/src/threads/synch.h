@@ -41,6 +41,29 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock.
+   Any number of threads may hold it shared, or a single thread may
+   hold it exclusive.  Waiting writers keep new readers out, so that
+   a steady stream of readers cannot starve a writer. */
+struct rw_lock
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition readers_ok;  /* Signaled when readers may enter. */
+    struct condition writer_ok;   /* Signaled when a writer may enter. */
+    int readers;                /* Number of threads holding it shared. */
+    int waiting_writers;        /* Number of threads waiting exclusive. */
+    struct thread *writer;      /* Thread holding it exclusive, if any. */
+  };
+
+void rw_lock_init (struct rw_lock *);
+void rw_lock_acquire_shared (struct rw_lock *);
+bool rw_lock_try_acquire_shared (struct rw_lock *);
+void rw_lock_release_shared (struct rw_lock *);
+void rw_lock_acquire_exclusive (struct rw_lock *);
+bool rw_lock_try_acquire_exclusive (struct rw_lock *);
+void rw_lock_release_exclusive (struct rw_lock *);
+bool rw_lock_held_exclusive (const struct rw_lock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -176,6 +176,25 @@ thread_awake (int64_t current_tick) {
     }
 }
 
+/* Puts the running thread to sleep in the wait queue until the
+   timer reaches TICKS_END; thread_awake() wakes it up again.
+
+   This function must be called with interrupts turned on. */
+void
+thread_sleep_until (int64_t ticks_end)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (cur != idle_thread);
+
+  old_level = intr_disable ();
+  cur->sleep_endtick = ticks_end;
+  list_push_back (&wait_list, &cur->waitelem);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
@@ -533,7 +552,8 @@ init_thread (struct thread *t, const char *name, int priority)
 
   /* init list of children */
   list_init (&t->children);
-  list_init(&t->file_descriptors);
+  t->fd_table = NULL;
+  t->fd_table_size = 0;
 
 #endif
 #ifdef VM
@@ -141,7 +141,8 @@ struct thread
 #endif
     // Project 4: CWD.
     struct dir *cwd;
-    struct list file_descriptors;       /* List of file_descriptors the thread contains */
+    struct file_descriptor **fd_table;  /* Open files, indexed by fd. */
+    int fd_table_size;                  /* Number of slots in fd_table. */
 
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
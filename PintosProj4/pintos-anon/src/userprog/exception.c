@@ -163,22 +163,33 @@ printf("----------------------------------------\n");
 
 #endif
 
-  if (!not_present) {
-    // printf("not_present\n");
-    exit (-1);
-    return;
-  }
-  
-
   void* esp = user ? f->esp : thread_current()->current_esp;
   bool success = true;
 #if VM
-  success = load_vm(esp, fault_addr);
-  if (success) {
+  if (not_present) {
+    success = load_vm(esp, fault_addr);
+    if (success) {
+      return;
+    }
+  }
+#endif
+
+  /* The kernel touched a bad user address while copying user memory:
+     let copy_user() fail, so that its caller can release what it
+     holds before the process is killed. */
+  if (!user && is_user_vaddr (fault_addr)
+      && (const char *) f->eip >= user_copy_begin
+      && (const char *) f->eip < user_copy_end) {
+    f->eip = (void *) f->eax;
+    f->eax = 0xffffffff;
     return;
   }
 
-#endif
+  if (!not_present) {
+    // printf("not_present\n");
+    exit (-1);
+    return;
+  }
 
   // printf("user: %d,  f->esp - fault_addr: %d\n", user, f->esp - fault_addr);
   
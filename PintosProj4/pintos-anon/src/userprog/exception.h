@@ -6,6 +6,12 @@
 #define PF_W 0x2    /* 0: read, 1: write. */
 #define PF_U 0x4    /* 0: kernel, 1: user process. */
 
+/* Bounds of the user memory copy in copy_user() (syscall.c).  A
+   kernel page fault on a bad user address between them resumes at
+   the address in eax with eax set to -1, instead of killing the
+   process, so that the caller can clean up and fail. */
+extern const char user_copy_begin[], user_copy_end[];
+
 void exception_init (void);
 void exception_print_stats (void);
 
@@ -244,15 +244,6 @@ process_exit (void)
   struct child_thread_status *child;
 
   /* Resources should be cleaned up */
-  // 1. file descriptors
-  struct list *fdlist = &cur->file_descriptors;
-  while (!list_empty(fdlist)) {
-    struct list_elem *e = list_pop_front (fdlist);
-    struct file_descriptor *desc = list_entry(e, struct file_descriptor, elem);
-    file_close(desc->file_struct);
-    palloc_free_page(desc); // see sys_open()
-  }
-  
 #ifdef VM
   // mmap descriptors
   struct list *mmlist = &cur->mmap_list;
@@ -332,19 +323,7 @@ process_exit (void)
   }
 
   /* close all file the process uses */
-  struct file_descriptor *fd_struct; 
-  e = list_begin (&open_files);
-  while (e != list_tail (&open_files)) {
-    next = list_next (e);
-    fd_struct = list_entry (e, struct file_descriptor, elem);
-    if (fd_struct->owner == cur->tid)
-    {
-      list_remove (e);
-      file_close (fd_struct->file_struct);
-      free (fd_struct);
-    }
-    e = next;
-  }  
+  close_all_open_files ();
 
   /* when exit cur, awake his parent */
   parent = cur->parent;
@@ -6,9 +6,13 @@
 #include "filesys/file.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/cache.h"
+#include <cache-stats.h>
+#include <dirent.h>
 #include "threads/palloc.h"
 #include "threads/malloc.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -29,7 +33,11 @@
 // #define DEBUG2
 struct lock sys_lock;
 static uint32_t *esp;
-static int fd_current = 3;
+
+/* Lowest file descriptor handed out: 0 and 1 are the console. */
+#define FD_MIN 2
+/* Initial number of slots in a process's fd table. */
+#define FD_TABLE_INITIAL 16
 
 static void syscall_handler (struct intr_frame *);
 
@@ -65,128 +73,237 @@ bool mkdir(const char *filename);
 bool readdir(int fd, char *filename);
 bool isdir(int fd);
 int inumber(int fd);
+void sync(void);
+bool cache_stats(struct cache_stats *stats);
+int getdents(int fd, struct dirent *entries, unsigned size);
 #endif
 
-// open file function
+// open file function.  a process's fd table is only ever used by its
+// own thread, so it needs no lock.
 struct file_descriptor *
 get_open_file (int fd)
 {
-  struct list_elem *e;
-  struct file_descriptor *fd_struct; 
-  e = list_tail (&open_files);
-  while ((e = list_prev (e)) != list_head (&open_files)) 
-    {
-      fd_struct = list_entry (e, struct file_descriptor, elem);
-      if (fd_struct->fd_num == fd)
-	return fd_struct;
-    }
-  return NULL;
+  struct thread *t = thread_current ();
+
+  if (fd < 0 || fd >= t->fd_table_size)
+    return NULL;
+  return t->fd_table[fd];
 }
 
+/* Puts FD_STRUCT into the lowest free slot of the current process's
+   fd table, growing the table if it is full, and returns that fd.
+   Returns -1 if out of memory. */
+static int
+install_open_file (struct file_descriptor *fd_struct)
+{
+  struct thread *t = thread_current ();
+  int fd;
 
+  for (fd = FD_MIN; fd < t->fd_table_size; fd++)
+    if (t->fd_table[fd] == NULL)
+      break;
 
-void
-close_open_file (int fd)
-{
-  struct list_elem *e;
-  struct list_elem *prev;
-  struct file_descriptor *fd_struct; 
-  e = list_end (&open_files);
-  while (e != list_head (&open_files)) 
-  {
-    prev = list_prev (e);
-    fd_struct = list_entry (e, struct file_descriptor, elem);
-    if (fd_struct->fd_num == fd)
+  if (fd == t->fd_table_size)
     {
-      list_remove (e);
-            file_close (fd_struct->file_struct);
-      free (fd_struct);
-      return ;
+      int size = t->fd_table_size > 0 ? t->fd_table_size * 2 : FD_TABLE_INITIAL;
+      struct file_descriptor **table = realloc (t->fd_table,
+                                                size * sizeof *table);
+      if (table == NULL)
+        return -1;
+      memset (table + t->fd_table_size, 0,
+              (size - t->fd_table_size) * sizeof *table);
+      t->fd_table = table;
+      t->fd_table_size = size;
     }
-    e = prev;
-  }
-}
 
+  t->fd_table[fd] = fd_struct;
+  fd_struct->fd_num = fd;
+  return fd;
+}
 
+void
+close_open_file (int fd)
+{
+  struct file_descriptor *fd_struct = get_open_file (fd);
+
+  if (fd_struct == NULL)
+    return;
+  thread_current ()->fd_table[fd] = NULL;
+  file_close (fd_struct->file_struct);
+  dir_close (fd_struct->dir);
+  free (fd_struct);
+}
 
-//if the program cannot load or run for any reason
-bool 
-is_good_ptr(const void *usr_ptr)
+/* Closes every file the current process has open, and frees its fd
+   table.  Called when the process exits. */
+void
+close_all_open_files (void)
 {
-  // printf("in is_good_ptr \n");
-  struct thread *cur = thread_current ();
-  if (usr_ptr != NULL && is_user_vaddr (usr_ptr))
-    {
-      // printf("%d\n",(pagedir_get_page (cur->pagedir, usr_ptr)) != NULL);
-      return (pagedir_get_page (cur->pagedir, usr_ptr)) != NULL;
-    }
-  // printf("0\n");
-  return false;
+  struct thread *t = thread_current ();
+  int fd;
+
+  for (fd = 0; fd < t->fd_table_size; fd++)
+    close_open_file (fd);
+  free (t->fd_table);
+  t->fd_table = NULL;
+  t->fd_table_size = 0;
 }
 
+
+
 void
 syscall_init (void) 
 {
-  lock_init (&filesys_lock);
-  list_init (&open_files);
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
 
-static int32_t
-get_user (const uint8_t *uaddr) {
-  // check that a user pointer `uaddr` points below PHYS_BASE
-  if (! ((void*)uaddr < PHYS_BASE)) {
-    return -1;
-  }
+// in case of invalid memory access, fail and exit.
+static void fail_invalid_access(void) {
+  exit (-1);
+  NOT_REACHED();
+}
+
+/* Returns true if the SIZE bytes at UADDR all lie below PHYS_BASE. */
+static bool
+is_user_range (const void *uaddr, size_t size)
+{
+  return (uintptr_t) uaddr < (uintptr_t) PHYS_BASE
+         && size <= (uintptr_t) PHYS_BASE - (uintptr_t) uaddr;
+}
 
-  // as suggested in the reference manual, see (3.1.5)
+/* Copies SIZE bytes from SRC to DST a word at a time, then the odd
+   bytes, where one of the two is user memory.  A bad user address
+   faults inside the copy: as the reference manual suggests (3.1.5),
+   the page fault handler then resumes at label 1 with eax set to -1.
+   Returns false if that happened.
+
+   The handler only does so for faults between user_copy_begin and
+   user_copy_end, which is why this function must not be inlined. */
+static bool NO_INLINE
+copy_user (void *dst, const void *src, size_t size)
+{
+  size_t words = size / sizeof (uint32_t);
   int result;
-  asm ("movl $1f, %0; movzbl %1, %0; 1:"
-      : "=&a" (result) : "m" (*uaddr));
-  return result;
+
+  asm volatile ("movl $1f, %0\n"
+                ".globl user_copy_begin\n"
+                "user_copy_begin:\n\t"
+                "rep movsl; movl %4, %%ecx; rep movsb\n"
+                ".globl user_copy_end\n"
+                "user_copy_end:\n"
+                "1:"
+                : "=&a" (result), "+D" (dst), "+S" (src), "+c" (words)
+                : "r" (size % sizeof (uint32_t))
+                : "memory");
+  return result != -1;
 }
 
-// in case of invalid memory access, fail and exit.
-static void fail_invalid_access(void) {
-  if (lock_held_by_current_thread(&filesys_lock))
-    lock_release (&filesys_lock);
+/* Copies SIZE bytes from user address USRC to kernel buffer DST.
+   Returns false if any of them is not valid user memory. */
+bool
+copy_from_user (void *dst, const void *usrc, size_t size)
+{
+  return is_user_range (usrc, size) && copy_user (dst, usrc, size);
+}
 
-  exit (-1);
-  NOT_REACHED();
+/* Copies SIZE bytes from kernel buffer SRC to user address UDST.
+   Returns false if any of them is not valid user memory. */
+bool
+copy_to_user (void *udst, const void *src, size_t size)
+{
+  return is_user_range (udst, size) && copy_user (udst, src, size);
 }
 
-static int
-memread_user (void *src, void *dst, size_t bytes)
+/* Copies the null-terminated string at user address USRC into DST,
+   which holds SIZE bytes, a page at a time: a page that holds part of
+   the string is valid as a whole.  Returns the string's length, SIZE
+   if it does not fit in DST, or -1 if it is not valid user memory. */
+int
+strncpy_from_user (char *dst, const char *usrc, size_t size)
 {
-  int32_t value;
-  size_t i;
-  for(i=0; i<bytes; i++) {
-    value = get_user(src + i);
-    if(value == -1) // segfault or invalid memory access
-      fail_invalid_access();
+  size_t copied = 0;
 
-    *(char*)(dst + i) = value & 0xff;
-  }
-  return (int)bytes;
+  while (copied < size)
+    {
+      const char *src = usrc + copied;
+      size_t chunk = PGSIZE - pg_ofs (src);
+      char *nul;
+
+      if (chunk > size - copied)
+        chunk = size - copied;
+      if (!copy_from_user (dst + copied, src, chunk))
+        return -1;
+      nul = memchr (dst + copied, '\0', chunk);
+      if (nul != NULL)
+        return nul - dst;
+      copied += chunk;
+    }
+  return size;
+}
+
+/* Returns a page holding a copy of the user string US, or a null
+   pointer if out of memory or if US is a page long or longer.  Kills
+   the process if US is not valid user memory.  The caller frees the
+   page. */
+static char *
+copy_in_string (const char *us)
+{
+  char *ks = palloc_get_page (0);
+  int len;
+
+  if (ks == NULL)
+    return NULL;
+  len = strncpy_from_user (ks, us, PGSIZE);
+  if (len == -1 || len == PGSIZE)
+    {
+      palloc_free_page (ks);
+      if (len == -1)
+        fail_invalid_access ();
+      return NULL;
+    }
+  return ks;
+}
+
+/* Returns how many argument words system call NUMBER takes, after
+   the number itself on the user stack. */
+static size_t
+syscall_arg_cnt (uint32_t number)
+{
+  static const uint8_t arg_cnt[] =
+    {
+      [SYS_HALT] = 0, [SYS_EXIT] = 1, [SYS_EXEC] = 1, [SYS_WAIT] = 1,
+      [SYS_CREATE] = 2, [SYS_REMOVE] = 1, [SYS_OPEN] = 1,
+      [SYS_FILESIZE] = 1, [SYS_READ] = 3, [SYS_WRITE] = 3, [SYS_SEEK] = 2,
+      [SYS_TELL] = 1, [SYS_CLOSE] = 1, [SYS_MMAP] = 2, [SYS_MUNMAP] = 1,
+      [SYS_CHDIR] = 1, [SYS_MKDIR] = 1, [SYS_READDIR] = 2, [SYS_ISDIR] = 1,
+      [SYS_INUMBER] = 1, [SYS_SYNC] = 0, [SYS_CACHE_STATS] = 1,
+      [SYS_GETDENTS] = 3,
+    };
+
+  return number < sizeof arg_cnt ? arg_cnt[number] : 0;
 }
 
 static void
 syscall_handler (struct intr_frame *f UNUSED) 
 {
+  uint32_t args[4];     /* Syscall number and up to three arguments. */
+
   esp = f->esp;
   thread_current()->current_esp = f->esp;
   #ifdef DEBUG
   printf ("system call!\n");
   #endif
-  if (!is_good_ptr (esp) || !is_good_ptr (esp + 1) ||
-    !is_good_ptr (esp + 2) || !is_good_ptr (esp + 3))
+  // only the words the call takes: its stack may end right after them.
+  if (!copy_from_user (args, esp, sizeof *args)
+      || !copy_from_user (args + 1, esp + 1,
+                          syscall_arg_cnt (args[0]) * sizeof *args))
   {
     exit (-1);
   }
   else
   {
-    int syscall_number = *(int *)(esp);
+    int syscall_number = args[0];
     #ifdef FILESYSDebug
       printf("sys num is %d \n",syscall_number);
     #endif
@@ -197,104 +314,123 @@ syscall_handler (struct intr_frame *f UNUSED)
         break;    
       }              
       case SYS_EXIT: {// 1
-        // printf("exit num %d\n",(int)(*(esp + 1)));
-        exit (*(esp + 1));
+        // printf("exit num %d\n",(int)(args[1]));
+        exit (args[1]);
         break;     
       }        
       case SYS_EXEC: {// 2
-        // printf("exec char %s\n",(char *) *(esp + 1));
-        f->eax = exec ((char *) *(esp + 1));
+        // printf("exec char %s\n",(char *) args[1]);
+        f->eax = exec ((char *) args[1]);
         break;    
       }                   
       case SYS_WAIT: {// 3
-        f->eax = wait (*(esp + 1));
+        f->eax = wait (args[1]);
         break;    
       }                    
       case SYS_CREATE: {// 4
-        // printf("create num %s\n",(char *) *(esp + 1));
-        f->eax = create ((char *) *(esp + 1), *(esp + 2));
+        // printf("create num %s\n",(char *) args[1]);
+        f->eax = create ((char *) args[1], args[2]);
         break;    
       }                    
       case SYS_REMOVE: {// 5
-        f->eax = remove ((char *) *(esp + 1));
+        f->eax = remove ((char *) args[1]);
         break;    
       }              
       case SYS_OPEN: {// 6
-        // printf("open num %s\n",(char *) *(esp + 1));
-        f->eax = open ((char *) *(esp + 1));
+        // printf("open num %s\n",(char *) args[1]);
+        f->eax = open ((char *) args[1]);
         break;    
       }              
       case SYS_FILESIZE: {// 7
-        f->eax = filesize (*(esp + 1));
+        f->eax = filesize (args[1]);
         break;    
       }              
       case SYS_READ: {// 8
-        // printf("read num1 %d\n",(int *) *(esp + 1));
-        // printf("read num2 %d\n",(int *) *(esp + 2));
-        // printf("read num3 %d\n",(int *) *(esp + 3));
+        // printf("read num1 %d\n",(int *) args[1]);
+        // printf("read num2 %d\n",(int *) args[2]);
+        // printf("read num3 %d\n",(int *) args[3]);
 
-        f->eax = read (*(esp + 1), (void *) *(esp + 2), *(esp + 3));
+        f->eax = read (args[1], (void *) args[2], args[3]);
         break;    
       }              
       case SYS_WRITE: {// 9
       #ifdef DEBUG2
-        printf("esp %p\n", *(esp));
-        printf("write num1 %p\n",(int *) *(esp + 1));
-        printf("write num2 %p\n",(int *) *(esp + 2));
-        printf("write num3 %p\n",(int *) *(esp + 3));
+        printf("esp %p\n", args[0]);
+        printf("write num1 %p\n",(int *) args[1]);
+        printf("write num2 %p\n",(int *) args[2]);
+        printf("write num3 %p\n",(int *) args[3]);
       #endif
-        f->eax = write (*(esp + 1), (void *) *(esp + 2), *(esp + 3));
+        f->eax = write (args[1], (void *) args[2], args[3]);
         break;      
       }
       case SYS_SEEK: {// 10
-        seek (*(esp + 1), *(esp + 2));
+        seek (args[1], args[2]);
         break;    
       }              
       case SYS_TELL: {// 11
-        f->eax = tell (*(esp + 1));
+        f->eax = tell (args[1]);
         break;    
       }              
       case SYS_CLOSE: {// 12
-        // printf("close tid num %d\n",(int *) *(esp + 1));
-        close (*(esp + 1));
+        // printf("close tid num %d\n",(int *) args[1]);
+        close (args[1]);
         break;    
       }              
       case SYS_MMAP:{ //13 This is the mmap handler
-	      f->eax = mmap (*(esp + 1), (void *) *(esp + 2));
+	      f->eax = mmap (args[1], (void *) args[2]);
         break;
       }           
       case SYS_MUNMAP:{ //14 This is the munmap handler
-	      f->eax = munmap (*(esp + 1));
+	      f->eax = munmap (args[1]);
         break;
       }
   #ifdef FILESYS
     case SYS_CHDIR: // 15
       {
-        f->eax = chdir(*(esp + 1));
+        f->eax = chdir(args[1]);
         break;
       }
 
     case SYS_MKDIR: // 16
       {
-        f->eax = mkdir(*(esp + 1));
+        f->eax = mkdir(args[1]);
         break;
       }
 
     case SYS_READDIR: // 17
       {
-        f->eax = readdir(*(esp + 1), *(esp + 2));
+        f->eax = readdir(args[1], args[2]);
         break;
       }
 
     case SYS_ISDIR: // 18
       {
-        f->eax = isdir(*(esp + 1));
+        f->eax = isdir(args[1]);
         break;
       }
 
     case SYS_INUMBER: // 19
       {
-        f->eax = inumber(*(esp + 1));
+        f->eax = inumber(args[1]);
+        break;
+      }
+
+    case SYS_SYNC: // 20
+      {
+        sync();
+        break;
+      }
+
+    case SYS_CACHE_STATS: // 21
+      {
+        f->eax = cache_stats((struct cache_stats *) args[1]);
+        break;
+      }
+
+    case SYS_GETDENTS: // 22
+      {
+        f->eax = getdents(args[1], (struct dirent *) args[2],
+                          args[3]);
         break;
       }
 
@@ -357,17 +493,14 @@ exec (const char *cmd_line)
    */
   tid_t tid;
   struct thread *cur;
+  char *kcmd_line = copy_in_string (cmd_line);
 
-  /* check if the user pinter is valid */
-  if (!is_good_ptr (cmd_line))
-  {
-    exit (-1);
-  }
+  if (kcmd_line == NULL)
+    return -1;
 
   cur = thread_current ();
-  lock_acquire (&filesys_lock); // load() uses filesystem
-  tid = process_execute (cmd_line);
-  lock_release (&filesys_lock);
+  tid = process_execute (kcmd_line);
+  palloc_free_page (kcmd_line);
   /* check if load fail */
   if (cur->child_load_status == -1)
     tid = -1;
@@ -382,13 +515,13 @@ bool
 create (const char *file_name, unsigned size)
 {
   bool status;
+  char *kfile_name = copy_in_string (file_name);
 
-  if (!is_good_ptr (file_name))
-    exit (-1);
+  if (kfile_name == NULL)
+    return false;
 
-  lock_acquire (&filesys_lock);
-  status = filesys_create(file_name, size,false);  
-  lock_release (&filesys_lock);
+  status = filesys_create(kfile_name, size,false);  
+  palloc_free_page (kfile_name);
   return status;
 }
 
@@ -397,12 +530,13 @@ bool
 remove (const char *file_name)
 {
   bool status;
-  if (!is_good_ptr (file_name))
-    exit (-1);
+  char *kfile_name = copy_in_string (file_name);
+
+  if (kfile_name == NULL)
+    return false;
 
-  lock_acquire (&filesys_lock);  
-  status = filesys_remove (file_name);
-  lock_release (&filesys_lock);
+  status = filesys_remove (kfile_name);
+  palloc_free_page (kfile_name);
   #ifdef  FILESYSDebug
     printf("state of remove %d\n",status);
   #endif
@@ -415,27 +549,28 @@ open (const char *file_name)
   struct file *f;
   struct file_descriptor *fd;
   int status = -1;
+  char *kfile_name = copy_in_string (file_name);
+
+  if (kfile_name == NULL)
+    return -1;
   #ifdef  FILESYSDebug
-    printf("file_name %s\n",file_name);
+    printf("file_name %s\n",kfile_name);
   #endif
-  if (!is_good_ptr(file_name))
-  {
-    exit (-1);
-  }
 
-  lock_acquire (&filesys_lock); 
- 
-  f = filesys_open (file_name);
+  f = filesys_open (kfile_name);
+  palloc_free_page (kfile_name);
   #ifdef  FILESYSDebug
     printf("f != NULL %d\n",f != NULL);
   #endif      
   if (f != NULL)
     {
       fd = calloc (1, sizeof *fd);
-      fd->fd_num =  ++fd_current;
-      fd->owner = thread_current ()->tid;
+      if (fd == NULL)
+        {
+          file_close (f);
+          return -1;
+        }
       fd->file_struct = f;
-      status = fd->fd_num;
     
 
 
@@ -449,7 +584,6 @@ open (const char *file_name)
       #ifdef FILESYSDebug
         printf("================================\n");
         printf("fd->dir %d\n",fd->dir != NULL);
-        printf("fd_open is %d\n",fd->fd_num);
         printf("================================\n");  
       #endif
         
@@ -459,15 +593,20 @@ open (const char *file_name)
         fd->dir = NULL;
       }
   
+  status = install_open_file (fd);
+  if (status == -1)
+    {
+      file_close (fd->file_struct);
+      dir_close (fd->dir);
+      free (fd);
+    }
+
 #ifdef FILESYSDebug
   printf("statue is:%d\n",status);
 #endif
 
-  list_push_back (&open_files, &fd->elem);
-
   
   }
-  lock_release (&filesys_lock);
   return status;
 }
 
@@ -475,12 +614,10 @@ int
 filesize (int fd)
 {
   struct file_descriptor *fd_struct;
-  lock_acquire (&filesys_lock); 
   int status = -1;
   fd_struct = get_open_file (fd);
   if (fd_struct != NULL)
     status = file_length (fd_struct->file_struct);
-  lock_release (&filesys_lock);
   return status;
 }
 
@@ -498,7 +635,6 @@ int read(int fd, void* buffer, unsigned size) {
       exit (-1);
     }
 
-  lock_acquire (&filesys_lock);   
   if (fd == STDOUT_FILENO)
       status = -1;
   else if (fd == STDIN_FILENO)
@@ -531,7 +667,6 @@ int read(int fd, void* buffer, unsigned size) {
       }
 	      
     }
-  lock_release (&filesys_lock);
   return status;
 }
 
@@ -552,7 +687,6 @@ write (int fd, const void *buffer, unsigned size)
 
 
 
-  lock_acquire (&filesys_lock); 
   if (fd == STDIN_FILENO)
     {
       status = -1;
@@ -583,7 +717,6 @@ write (int fd, const void *buffer, unsigned size)
 #endif
       }
     }
-  lock_release (&filesys_lock);
   // printf("end write\n");
 
   return status;
@@ -594,24 +727,20 @@ write (int fd, const void *buffer, unsigned size)
 void 
 seek (int fd, unsigned position)
 {
-  lock_acquire (&filesys_lock); 
   struct file_descriptor *fd_struct;
   fd_struct = get_open_file (fd);
   if (fd_struct != NULL)
     file_seek (fd_struct->file_struct, position);
-  lock_release (&filesys_lock);
 }
 
 unsigned 
 tell (int fd)
 {
-  lock_acquire (&filesys_lock); 
   struct file_descriptor *fd_struct;
   int status = -1;
   fd_struct = get_open_file (fd);
   if (fd_struct != NULL)
     status = file_tell (fd_struct->file_struct);
-  lock_release (&filesys_lock);
   return status;
 }
 
@@ -619,12 +748,10 @@ tell (int fd)
 void 
 close (int fd)
 {
-  lock_acquire (&filesys_lock); 
   struct file_descriptor *fd_struct;
   fd_struct = get_open_file (fd);
-  if (fd_struct != NULL && fd_struct->owner == thread_current ()->tid)
+  if (fd_struct != NULL)
     close_open_file (fd);
-  lock_release (&filesys_lock);
 }
 
 #ifdef VM
@@ -637,7 +764,6 @@ mmapid_t mmap(int fd, void *upage) {
   if (fd <= 1) return -1; // 0 and 1 are unmappable
   struct thread *curr = thread_current();
 
-  lock_acquire (&filesys_lock);
 
   /* 1. Open file */
   struct file *f = NULL;
@@ -685,13 +811,11 @@ mmapid_t mmap(int fd, void *upage) {
   list_push_back (&curr->mmap_list, &mmap_d->elem);
 
   // OK, release and return the mid
-  lock_release (&filesys_lock);
   return mid;
 
 
 MMAP_FAIL:
   // finally: release and return
-  lock_release (&filesys_lock);
   #ifdef DEBUG
   printf("fail\n");
   #endif
@@ -713,7 +837,6 @@ bool munmap (mmapid_t mid)
     return false; // or fail_invalid_access() ?
   }
 
-  lock_acquire (&filesys_lock);
   {
     // Iterate through each page
     size_t offset, file_size = mmap_d->size;
@@ -736,7 +859,6 @@ bool munmap (mmapid_t mid)
     file_close(mmap_d->file);
     free(mmap_d);
   }
-  lock_release (&filesys_lock);
 
   return true;
 }
@@ -794,10 +916,12 @@ void unpin_preloaded_pages(const void *buffer, size_t size)
 bool mkdir(const char *filename)
 {
   bool return_code;
+  char *kfilename = copy_in_string (filename);
 
-  lock_acquire (&filesys_lock);
-  return_code = filesys_create(filename, 0, true);
-  lock_release (&filesys_lock);
+  if (kfilename == NULL)
+    return false;
+  return_code = filesys_create(kfilename, 0, true);
+  palloc_free_page (kfilename);
   #ifdef FILESYSDebug
     printf("mkdir success?: %d\n",return_code);
   #endif
@@ -808,9 +932,12 @@ bool mkdir(const char *filename)
 bool chdir(const char *filename)
 {
   bool return_code;
-  lock_acquire (&filesys_lock);
-  return_code = filesys_chdir(filename);
-  lock_release (&filesys_lock);
+  char *kfilename = copy_in_string (filename);
+
+  if (kfilename == NULL)
+    return false;
+  return_code = filesys_chdir(kfilename);
+  palloc_free_page (kfilename);
   #ifdef FILESYSDebug
     printf("chdir success?: %d\n",return_code);
   #endif
@@ -820,61 +947,107 @@ bool chdir(const char *filename)
 bool readdir(int fd, char *name)
 {
   struct file_descriptor* file_d;
+  char kname[NAME_MAX + 1];
   bool ret = false;
 
-  lock_acquire (&filesys_lock);
   file_d = get_open_file (fd);
-  if (file_d == NULL) {
-    lock_release (&filesys_lock);
+  if (file_d == NULL)
     return false;
-  }
   struct inode *inode;
   inode = file_get_inode(file_d->file_struct); // file descriptor -> inode
-  if(inode == NULL) {
-    lock_release (&filesys_lock);
+  if(inode == NULL)
     return false;
-  }
   // check whether it is a valid directory
-  if(! inode_is_directory(inode)) {
-    lock_release (&filesys_lock);
+  if(! inode_is_directory(inode))
     return false;
-  }
   struct file *file = file_d->file_struct;
   off_t pos = file_tell(file);
   struct dir *dir = dir_open(inode);
   dir_seek(dir, pos);
-  ret = dir_readdir (file_d->dir, name);
+  ret = dir_readdir (file_d->dir, kname);
+  if (ret && !copy_to_user (name, kname, strlen (kname) + 1))
+    fail_invalid_access ();
   file_seek(file, dir_tell(dir));
   free(dir);
-  lock_release (&filesys_lock);
   return ret;
 }
 
 bool isdir(int fd)
 {
-  lock_acquire (&filesys_lock);
 
   struct file_descriptor* file_d = get_open_file (fd);
   if (!file_d)
     return false;
   bool ret = inode_is_directory (file_get_inode(file_d->file_struct));
 
-  lock_release (&filesys_lock);
   return ret;
 }
 
 int inumber(int fd)
 {
-  lock_acquire (&filesys_lock);
 
   struct file_descriptor* file_d = get_open_file (fd);
   if (!file_d)
     return -1;
   int ret = (int) inode_get_inumber (file_get_inode(file_d->file_struct));
 
-  lock_release (&filesys_lock);
   return ret;
 }
 
+void sync(void)
+{
+  inode_flush_all ();
+  buffer_cache_flush ();
+}
+
+bool cache_stats(struct cache_stats *stats)
+{
+  struct cache_stats kstats;
+
+  buffer_cache_get_stats (&kstats);
+  if (!copy_to_user (stats, &kstats, sizeof kstats))
+    fail_invalid_access ();
+  return true;
+}
+
+/* Most entries getdents() reads per dir_getdents() call. */
+#define GETDENTS_BATCH (PGSIZE / sizeof (struct dirent))
+
+/* Reads as many entries of directory FD as fit into the SIZE bytes
+   at ENTRIES, in one trap rather than one per entry as readdir().
+   Returns the number of entries read, 0 at the end of the directory,
+   or -1 if FD is not an open directory. */
+int getdents(int fd, struct dirent *entries, unsigned size)
+{
+  struct file_descriptor *file_d = get_open_file (fd);
+  size_t cnt = size / sizeof (struct dirent);
+  size_t total = 0;
+
+  if (file_d == NULL || file_d->dir == NULL)
+    return -1;
+  if (cnt == 0)
+    return 0;
+
+  struct dirent *buffer = malloc ((cnt < GETDENTS_BATCH ? cnt : GETDENTS_BATCH)
+                                  * sizeof *buffer);
+  if (buffer == NULL)
+    return -1;
+  while (total < cnt)
+    {
+      size_t want = cnt - total < GETDENTS_BATCH ? cnt - total : GETDENTS_BATCH;
+      size_t n = dir_getdents (file_d->dir, buffer, want);
+      if (!copy_to_user (entries + total, buffer, n * sizeof *buffer))
+        {
+          free (buffer);
+          fail_invalid_access ();
+        }
+      total += n;
+      if (n < want)
+        break;
+    }
+  free (buffer);
+  return (int) total;
+}
+
 
 #endif
\ No newline at end of file
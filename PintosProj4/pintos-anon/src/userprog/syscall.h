@@ -10,9 +10,7 @@ typedef int pid_t;
 struct file_descriptor
 {
   int fd_num;
-  tid_t owner;
   struct file *file_struct;
-  struct list_elem elem;
   struct dir* dir;        /* In case of directory opening, dir != NULL */
   
 
@@ -33,10 +31,11 @@ struct mmap_desc {
 };
 #endif
 
-struct list open_files; 
-struct lock filesys_lock;
-
-
 void syscall_init (void);
+void close_all_open_files (void);
+
+bool copy_from_user (void *dst, const void *usrc, size_t size);
+bool copy_to_user (void *udst, const void *src, size_t size);
+int strncpy_from_user (char *dst, const char *usrc, size_t size);
 
 #endif /* userprog/syscall.h */
@@ -12,6 +12,9 @@
 #include "threads/palloc.h"
 #include "userprog/pagedir.h"
 #include "threads/vaddr.h"
+#ifdef FILESYS
+#include "filesys/cache.h"
+#endif
 
 // #define DEBUG
 
@@ -151,6 +154,11 @@ vm_frame_allocate (enum palloc_flags flags, void *upage)
   lock_acquire (&frame_lock);
 
   void *frame_page = palloc_get_page (PAL_USER | flags);
+#ifdef FILESYS
+  // the buffer cache shares the user pool: take back one of its clean pages.
+  if (frame_page == NULL && buffer_cache_shrink (1) > 0)
+    frame_page = palloc_get_page (PAL_USER | flags);
+#endif
   if (frame_page == NULL) {
     // page allocation failed.
     #ifdef DEBUG